@@ -0,0 +1,184 @@
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include <model.h>
+#include <thread_pool.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+using namespace std;
+
+// Loads Models in parallel. Worker threads parse the model files (or map their mesh cache) and decode every
+// texture as a separate job; finished models are queued for the GL thread, which performs only the upload
+// when it calls pump() or one of the wait functions.
+class AssetLoader
+{
+public:
+    explicit AssetLoader(unsigned int threadCount = 0) : pool(threadCount) {}
+
+    // loads still queued on the pool are dropped rather than run by its destructor: their futures are left
+    // unsatisfied, and their Models may already be gone
+    ~AssetLoader()
+    {
+        stopping = true;
+    }
+
+    AssetLoader(const AssetLoader&) = delete;
+    AssetLoader& operator=(const AssetLoader&) = delete;
+
+    // starts loading path into model, which must stay alive until the returned future is ready. Required
+    // models are the ones waitRequired() blocks on; the rest can trickle in through pump() while rendering.
+    shared_future<void> load(Model& model, const string& path, bool required = true)
+    {
+        shared_ptr<Request> request = make_shared<Request>();
+        request->model = &model;
+        request->vertexLayout = model.vertexLayout;
+        request->keepOccluder = model.keepOccluder;
+        request->path = path;
+        request->required = required;
+        shared_future<void> ready = request->ready.get_future().share();
+        {
+            lock_guard<mutex> lock(queueMutex);
+            outstanding++;
+            if (required)
+                outstandingRequired++;
+        }
+        pool.submit([this, request] { read(request); });
+        return ready;
+    }
+
+    // uploads up to maxUploads finished models on the calling (GL) thread without waiting; returns how many it did
+    unsigned int pump(unsigned int maxUploads = ~0u)
+    {
+        unsigned int uploaded = 0;
+        while (uploaded < maxUploads)
+        {
+            shared_ptr<Request> request;
+            {
+                lock_guard<mutex> lock(queueMutex);
+                if (uploads.empty())
+                    break;
+                request = uploads.front();
+                uploads.pop_front();
+            }
+            upload(request);
+            uploaded++;
+        }
+        return uploaded;
+    }
+
+    // completion barrier: uploads models as they become ready until every required one is in
+    void waitRequired()
+    {
+        waitUntil([this] { return outstandingRequired == 0; });
+    }
+
+    // completion barrier for every model handed to load()
+    void waitAll()
+    {
+        waitUntil([this] { return outstanding == 0; });
+    }
+
+    // number of models not uploaded yet
+    unsigned int pending()
+    {
+        lock_guard<mutex> lock(queueMutex);
+        return outstanding;
+    }
+
+private:
+    struct Request {
+        Model* model = nullptr;     // only touched on the GL thread; the workers use the copies below
+        VertexLayout vertexLayout = VertexLayout::Packed;
+        bool keepOccluder = false;
+        string path;
+        bool required = true;
+        ModelData data;
+        atomic<int> imagesLeft{ 0 };
+        promise<void> ready;
+    };
+
+    mutex queueMutex;
+    condition_variable uploadReady;
+    deque<shared_ptr<Request>> uploads;     // decoded models waiting for the GL thread
+    unsigned int outstanding = 0;
+    unsigned int outstandingRequired = 0;
+    atomic<bool> stopping{ false };
+    // declared last so its workers are joined before the queue they push into is destroyed
+    ThreadPool pool;
+
+    // worker: parse the model (its parallel passes going to whichever workers are idle), then fan out one decode
+    // job per claimed texture; the last one to finish queues the upload
+    void read(const shared_ptr<Request>& request)
+    {
+        if (stopping)
+            return;
+        Model::ReadModelData(request->path, request->data, request->vertexLayout, request->keepOccluder, &pool);
+        // only the images this model claimed need decoding; the rest are shared with another load
+        vector<size_t> decode;
+        for (size_t i = 0; i < request->data.images.size(); i++)
+            if (request->data.images[i].claimed)
+                decode.push_back(i);
+        if (decode.empty())
+        {
+            queueUpload(request);
+            return;
+        }
+        request->imagesLeft = static_cast<int>(decode.size());
+        for (size_t i : decode)
+        {
+            pool.submit([this, request, i]
+            {
+                if (stopping)
+                    return;
+                DecodeImage(request->data.images[i], request->data.directory);
+                if (--request->imagesLeft == 0)
+                    queueUpload(request);
+            });
+        }
+    }
+
+    void queueUpload(const shared_ptr<Request>& request)
+    {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            uploads.push_back(request);
+        }
+        uploadReady.notify_one();
+    }
+
+    // GL thread: create the buffers and textures, then drop the CPU-side data (and any mapped cache)
+    void upload(const shared_ptr<Request>& request)
+    {
+        request->model->Upload(request->data);
+        request->data = ModelData();
+        {
+            lock_guard<mutex> lock(queueMutex);
+            outstanding--;
+            if (request->required)
+                outstandingRequired--;
+        }
+        request->ready.set_value();
+    }
+
+    template <typename Predicate>
+    void waitUntil(Predicate done)
+    {
+        for (;;)
+        {
+            {
+                unique_lock<mutex> lock(queueMutex);
+                uploadReady.wait(lock, [&] { return done() || !uploads.empty(); });
+                if (done())
+                    return;
+            }
+            pump(1);
+        }
+    }
+};
+#endif
@@ -0,0 +1,359 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm.hpp>
+
+#include <frustum.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+using namespace std;
+
+// centroid bins per axis tried when splitting a node, and the limits that end a branch in a leaf
+#define BVH_BINS 16
+#define BVH_MAX_LEAF_ITEMS 4
+#define BVH_MAX_DEPTH 64
+
+// an axis-aligned box; the default one is empty and grows to enclose whatever it is given
+struct Bounds {
+    glm::vec3 low = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 high = glm::vec3(-std::numeric_limits<float>::max());
+
+    Bounds()
+    {
+    }
+
+    Bounds(const glm::vec3& low, const glm::vec3& high) : low(low), high(high)
+    {
+    }
+
+    void grow(const glm::vec3& point)
+    {
+        low = glm::min(low, point);
+        high = glm::max(high, point);
+    }
+
+    void grow(const Bounds& other)
+    {
+        low = glm::min(low, other.low);
+        high = glm::max(high, other.high);
+    }
+
+    bool empty() const { return low.x > high.x || low.y > high.y || low.z > high.z; }
+    glm::vec3 center() const { return (low + high) * 0.5f; }
+
+    float area() const
+    {
+        if (empty())
+            return 0.0f;
+        glm::vec3 size = high - low;
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+
+    bool operator==(const Bounds& other) const { return low == other.low && high == other.high; }
+};
+
+// the world box around a model-space box placed with transform: the center is moved, the half extents are taken
+// through the absolute values of the rotation and scale (Arvo)
+inline Bounds TransformBounds(const glm::mat4& transform, const Bounds& box)
+{
+    if (box.empty())
+        return box;
+    glm::vec3 center = glm::vec3(transform * glm::vec4(box.center(), 1.0f));
+    glm::vec3 half = (box.high - box.low) * 0.5f;
+    glm::vec3 extent(0.0f);
+    for (int column = 0; column < 3; column++)
+        extent += glm::abs(glm::vec3(transform[column])) * half[column];
+    return Bounds(center - extent, center + extent);
+}
+
+// the largest factor by which transform stretches any axis, i.e. what a model-space radius is scaled by
+inline float MaxAxisScale(const glm::mat4& transform)
+{
+    return std::max(glm::length(glm::vec3(transform[0])), std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+}
+
+// Bounding volume hierarchy over a set of boxes ("items", numbered as given to build). Nodes are split where the
+// surface area heuristic is lowest, estimated on BVH_BINS centroid bins per axis, and a node becomes a leaf when no
+// split is cheaper than testing its items one by one. Items that move are refitted in place by update(), which
+// grows or shrinks the boxes on the way to the root and stops where one no longer changes; the topology is kept,
+// so a tree whose items have moved far from where it was built should be built again.
+//
+// query() visits the items whose boxes intersect a frustum, skipping the plane tests below any node entirely inside
+// it; raycast() finds the nearest item along a ray, visiting the nearer child first and skipping what lies beyond
+// the nearest hit so far.
+class BVH
+{
+public:
+    typedef uint32_t ItemId;
+    static constexpr ItemId NO_ITEM = 0xFFFFFFFFu;
+
+    // builds the tree from scratch over items (indexed by ItemId)
+    void build(const vector<Bounds>& items)
+    {
+        boxes = items;
+        order.resize(boxes.size());
+        for (ItemId item = 0; item < boxes.size(); item++)
+            order[item] = item;
+        centroids.resize(boxes.size());
+        for (size_t i = 0; i < boxes.size(); i++)
+            centroids[i] = boxes[i].center();
+        nodes.clear();
+        parents.clear();
+        leafOf.assign(boxes.size(), NO_NODE);
+        if (boxes.empty())
+            return;
+        nodes.reserve(2 * boxes.size());
+        parents.reserve(2 * boxes.size());
+
+        struct Pending { uint32_t node, first, count, depth; };
+        vector<Pending> pending;
+        nodes.push_back(Node());
+        parents.push_back(NO_NODE);
+        pending.push_back({ 0, 0, static_cast<uint32_t>(boxes.size()), 0 });
+        while (!pending.empty())
+        {
+            Pending task = pending.back();
+            pending.pop_back();
+            Bounds box, centers;
+            for (uint32_t i = task.first; i < task.first + task.count; i++)
+            {
+                box.grow(boxes[order[i]]);
+                centers.grow(centroids[order[i]]);
+            }
+            nodes[task.node].box = box;
+
+            int axis = -1;
+            uint32_t splitBin = 0;
+            float splitCost = std::numeric_limits<float>::max();
+            if (task.count > 1 && task.depth + 1 < BVH_MAX_DEPTH)
+                findSplit(task.first, task.count, centers, axis, splitBin, splitCost);
+            // a split costs one more box test per visit, and then its two halves' items weighted by their areas
+            bool leaf = axis < 0 || (task.count <= BVH_MAX_LEAF_ITEMS && box.area() + splitCost >= task.count * box.area());
+            if (leaf)
+            {
+                nodes[task.node].first = task.first;
+                nodes[task.node].count = task.count;
+                for (uint32_t i = task.first; i < task.first + task.count; i++)
+                    leafOf[order[i]] = task.node;
+                continue;
+            }
+
+            float low = centers.low[axis], scale = BVH_BINS / (centers.high[axis] - low);
+            ItemId* middle = std::partition(&order[task.first], &order[task.first] + task.count,
+                [&](ItemId item) { return bin(centroids[item][axis], low, scale) < splitBin; });
+            uint32_t leftCount = static_cast<uint32_t>(middle - &order[task.first]);
+
+            uint32_t left = static_cast<uint32_t>(nodes.size());
+            nodes.push_back(Node());
+            nodes.push_back(Node());
+            parents.push_back(task.node);
+            parents.push_back(task.node);
+            nodes[task.node].first = left;
+            nodes[task.node].count = 0;
+            pending.push_back({ left, task.first, leftCount, task.depth + 1 });
+            pending.push_back({ left + 1, task.first + leftCount, task.count - leftCount, task.depth + 1 });
+        }
+        centroids.clear();
+        centroids.shrink_to_fit();
+    }
+
+    // moves an item to its new box and refits the nodes above it
+    void update(ItemId item, const Bounds& box)
+    {
+        boxes[item] = box;
+        uint32_t node = leafOf[item];
+        Bounds fitted;
+        for (uint32_t i = nodes[node].first; i < nodes[node].first + nodes[node].count; i++)
+            fitted.grow(boxes[order[i]]);
+        while (node != NO_NODE && !(nodes[node].box == fitted))
+        {
+            nodes[node].box = fitted;
+            node = parents[node];
+            if (node != NO_NODE)
+            {
+                fitted = nodes[nodes[node].first].box;
+                fitted.grow(nodes[nodes[node].first + 1].box);
+            }
+        }
+    }
+
+    // calls visit(item) for every item whose box intersects the frustum (see Frustum::intersects)
+    template <class Visit>
+    void query(const Frustum& frustum, Visit visit) const
+    {
+        if (nodes.empty())
+            return;
+        struct Entry { uint32_t node; bool inside; };
+        Entry stack[BVH_MAX_DEPTH + 1];
+        int top = 0;
+        stack[top++] = { 0, false };
+        while (top > 0)
+        {
+            Entry entry = stack[--top];
+            const Node& node = nodes[entry.node];
+            if (!entry.inside)
+            {
+                if (!frustum.intersects(node.box.low, node.box.high))
+                    continue;
+                entry.inside = frustum.contains(node.box.low, node.box.high);
+            }
+            if (node.count == 0)
+            {
+                stack[top++] = { node.first, entry.inside };
+                stack[top++] = { node.first + 1, entry.inside };
+                continue;
+            }
+            for (uint32_t i = node.first; i < node.first + node.count; i++)
+                if (entry.inside || frustum.intersects(boxes[order[i]].low, boxes[order[i]].high))
+                    visit(order[i]);
+        }
+    }
+
+    // finds the nearest item along the ray within distance, which is updated to the hit. intersect(item, entry)
+    // decides each candidate whose box the ray enters at entry, returning where it hits the item or infinity for a
+    // miss. False if nothing was hit.
+    template <class Intersect>
+    bool raycast(const glm::vec3& origin, const glm::vec3& direction, float& distance, ItemId& hit, Intersect intersect) const
+    {
+        hit = NO_ITEM;
+        if (nodes.empty())
+            return false;
+        glm::vec3 inverse = 1.0f / direction;
+        struct Entry { uint32_t node; float entry; };
+        Entry stack[BVH_MAX_DEPTH + 1];
+        int top = 0;
+        float rootEntry = enter(nodes[0].box, origin, inverse, distance);
+        if (rootEntry <= distance)
+            stack[top++] = { 0, rootEntry };
+        while (top > 0)
+        {
+            Entry entry = stack[--top];
+            // something nearer was hit since this node was pushed
+            if (entry.entry > distance)
+                continue;
+            const Node& node = nodes[entry.node];
+            if (node.count == 0)
+            {
+                uint32_t nearer = node.first, further = node.first + 1;
+                float nearerEntry = enter(nodes[nearer].box, origin, inverse, distance);
+                float furtherEntry = enter(nodes[further].box, origin, inverse, distance);
+                if (furtherEntry < nearerEntry)
+                {
+                    std::swap(nearer, further);
+                    std::swap(nearerEntry, furtherEntry);
+                }
+                if (furtherEntry <= distance)
+                    stack[top++] = { further, furtherEntry };
+                if (nearerEntry <= distance)
+                    stack[top++] = { nearer, nearerEntry };
+                continue;
+            }
+            for (uint32_t i = node.first; i < node.first + node.count; i++)
+            {
+                float boxEntry = enter(boxes[order[i]], origin, inverse, distance);
+                if (boxEntry > distance)
+                    continue;
+                float at = intersect(order[i], boxEntry);
+                if (at <= distance)
+                {
+                    distance = at;
+                    hit = order[i];
+                }
+            }
+        }
+        return hit != NO_ITEM;
+    }
+
+    // the nearest item whose box the ray enters, at the point it enters
+    bool raycast(const glm::vec3& origin, const glm::vec3& direction, float& distance, ItemId& hit) const
+    {
+        return raycast(origin, direction, distance, hit, [](ItemId, float entry) { return entry; });
+    }
+
+    // where the ray (with 1 / direction given as inverse) enters box, if it does before maxDistance; infinity if not
+    static float enter(const Bounds& box, const glm::vec3& origin, const glm::vec3& inverse, float maxDistance)
+    {
+        glm::vec3 t0 = (box.low - origin) * inverse;
+        glm::vec3 t1 = (box.high - origin) * inverse;
+        glm::vec3 nearest = glm::min(t0, t1), furthest = glm::max(t0, t1);
+        float entry = std::max(std::max(nearest.x, nearest.y), std::max(nearest.z, 0.0f));
+        float exit = std::min(std::min(furthest.x, furthest.y), std::min(furthest.z, maxDistance));
+        return entry <= exit ? entry : std::numeric_limits<float>::infinity();
+    }
+
+    size_t size() const { return boxes.size(); }
+    size_t nodeCount() const { return nodes.size(); }
+    const Bounds& bounds(ItemId item) const { return boxes[item]; }
+
+private:
+    static constexpr uint32_t NO_NODE = 0xFFFFFFFFu;
+
+    // an inner node has count 0 and its children at first and first + 1; a leaf holds order[first, first + count)
+    struct Node {
+        Bounds box;
+        uint32_t first = 0;
+        uint32_t count = 0;
+    };
+
+    vector<Node> nodes;
+    vector<uint32_t> parents;
+    vector<ItemId> order;
+    vector<uint32_t> leafOf;
+    vector<Bounds> boxes;
+    vector<glm::vec3> centroids;    // only while building
+
+    static uint32_t bin(float centroid, float low, float scale)
+    {
+        return std::min(static_cast<uint32_t>((centroid - low) * scale), static_cast<uint32_t>(BVH_BINS - 1));
+    }
+
+    // the cheapest split of order[first, first + count) between two neighbouring centroid bins, over all axes;
+    // axis stays -1 if the centroids coincide
+    void findSplit(uint32_t first, uint32_t count, const Bounds& centers, int& axis, uint32_t& splitBin, float& splitCost) const
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            float low = centers.low[a], extent = centers.high[a] - low;
+            if (!(extent > 0.0f))
+                continue;
+            float scale = BVH_BINS / extent;
+            Bounds binBoxes[BVH_BINS];
+            uint32_t binCounts[BVH_BINS] = {};
+            for (uint32_t i = first; i < first + count; i++)
+            {
+                uint32_t b = bin(centroids[order[i]][a], low, scale);
+                binBoxes[b].grow(boxes[order[i]]);
+                binCounts[b]++;
+            }
+            // sweep from the right to know each split's right half, then from the left to price them
+            float rightCosts[BVH_BINS];
+            Bounds right;
+            uint32_t rightCount = 0;
+            for (int b = BVH_BINS - 1; b > 0; b--)
+            {
+                right.grow(binBoxes[b]);
+                rightCount += binCounts[b];
+                rightCosts[b] = rightCount * right.area();
+            }
+            Bounds left;
+            uint32_t leftCount = 0;
+            for (uint32_t b = 1; b < BVH_BINS; b++)
+            {
+                left.grow(binBoxes[b - 1]);
+                leftCount += binCounts[b - 1];
+                float cost = leftCount * left.area() + rightCosts[b];
+                if (leftCount > 0 && leftCount < count && cost < splitCost)
+                {
+                    axis = a;
+                    splitBin = b;
+                    splitCost = cost;
+                }
+            }
+        }
+    }
+};
+#endif
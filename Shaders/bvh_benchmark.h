@@ -0,0 +1,157 @@
+#ifndef BVH_BENCHMARK_H
+#define BVH_BENCHMARK_H
+
+#include <glm.hpp>
+#include <gtc/matrix_transform.hpp>
+
+#include <bvh.h>
+#include <frustum.h>
+
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+using namespace std;
+
+// Offline comparison of the BVH against the flat passes it replaces: placement boxes scattered over a park
+// four kilometres across, culled against the frusta of random cameras and hit by random rays, both linearly and
+// through the tree, with a refit of one placement in a hundred per frame against a full rebuild. Every query is
+// checked to give the same answer both ways. Run with `--bench-bvh [placements]`; returns non-zero on a mismatch
+// or when there is nothing to place.
+inline int BenchmarkBVH(size_t placements)
+{
+    if (placements == 0)
+    {
+        cout << "ERROR::BVH:: no placements to benchmark" << endl;
+        return 1;
+    }
+    typedef std::chrono::steady_clock Clock;
+    auto milliseconds = [](Clock::duration duration) { return std::chrono::duration<double, std::milli>(duration).count(); };
+    const int views = 256, rays = 4096, frames = 64;
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> ground(-2000.0f, 2000.0f), height(0.0f, 100.0f), unit(0.0f, 1.0f);
+
+    vector<Bounds> items(placements);
+    SphereBounds spheres;
+    for (Bounds& item : items)
+    {
+        glm::vec3 center(ground(random), height(random), ground(random));
+        glm::vec3 half = glm::vec3(1.0f + 39.0f * unit(random) * unit(random));
+        item = Bounds(center - half, center + half);
+        spheres.push(center, glm::length(half));
+    }
+
+    Clock::time_point start = Clock::now();
+    BVH bvh;
+    bvh.build(items);
+    double buildTime = milliseconds(Clock::now() - start);
+    cout << "BVH:: " << placements << " placements, " << bvh.nodeCount() << " nodes, built in " << std::fixed << std::setprecision(2) << buildTime << " ms" << endl;
+
+    // frustum culling: boxes one by one, spheres four at a time (as the render queue does), then the tree
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 1000.0f);
+    vector<Frustum> frusta;
+    for (int v = 0; v < views; v++)
+    {
+        glm::vec3 eye(ground(random), 20.0f + height(random), ground(random));
+        float yaw = unit(random) * 6.2831853f;
+        frusta.push_back(Frustum::FromMatrix(projection * glm::lookAt(eye, eye + glm::vec3(std::cos(yaw), -0.1f, std::sin(yaw)), glm::vec3(0.0f, 1.0f, 0.0f))));
+    }
+    vector<size_t> linearVisible(views, 0), treeVisible(views, 0);
+    vector<uint8_t> visible(placements);
+    size_t sphereVisible = 0;
+    start = Clock::now();
+    for (int v = 0; v < views; v++)
+        for (const Bounds& item : items)
+            linearVisible[v] += frusta[v].intersects(item.low, item.high) ? 1 : 0;
+    double linearTime = milliseconds(Clock::now() - start) / views;
+    start = Clock::now();
+    for (int v = 0; v < views; v++)
+        sphereVisible += CullSpheres(frusta[v], spheres, visible.data());
+    double sphereTime = milliseconds(Clock::now() - start) / views;
+    start = Clock::now();
+    for (int v = 0; v < views; v++)
+        bvh.query(frusta[v], [&](BVH::ItemId) { treeVisible[v]++; });
+    double treeTime = milliseconds(Clock::now() - start) / views;
+    size_t mismatches = 0, total = 0;
+    for (int v = 0; v < views; v++)
+    {
+        mismatches += linearVisible[v] != treeVisible[v] ? 1 : 0;
+        total += treeVisible[v];
+    }
+    cout << "BVH:: frustum, " << total / views << " boxes (" << sphereVisible / views << " spheres) visible on average: linear boxes " << std::setprecision(4) << linearTime << " ms, linear spheres (SIMD) "
+        << sphereTime << " ms, tree " << treeTime << " ms (" << std::setprecision(1) << linearTime / treeTime << "x)" << endl;
+
+    // rays from above the park in random directions, nearest box hit
+    vector<glm::vec3> origins(rays), directions(rays);
+    for (int r = 0; r < rays; r++)
+    {
+        origins[r] = glm::vec3(ground(random), 150.0f, ground(random));
+        directions[r] = glm::normalize(glm::vec3(unit(random) - 0.5f, -unit(random), unit(random) - 0.5f));
+    }
+    vector<BVH::ItemId> linearHits(rays, BVH::NO_ITEM), treeHits(rays, BVH::NO_ITEM);
+    vector<float> linearDistances(rays, 5000.0f), treeDistances(rays, 5000.0f);
+    start = Clock::now();
+    for (int r = 0; r < rays; r++)
+    {
+        glm::vec3 inverse = 1.0f / directions[r];
+        float& distance = linearDistances[r];
+        for (BVH::ItemId item = 0; item < placements; item++)
+        {
+            float entry = BVH::enter(items[item], origins[r], inverse, distance);
+            if (entry <= distance)
+            {
+                distance = entry;
+                linearHits[r] = item;
+            }
+        }
+    }
+    linearTime = milliseconds(Clock::now() - start) / rays;
+    start = Clock::now();
+    for (int r = 0; r < rays; r++)
+        bvh.raycast(origins[r], directions[r], treeDistances[r], treeHits[r]);
+    treeTime = milliseconds(Clock::now() - start) / rays;
+    size_t rayMismatches = 0, hits = 0;
+    for (int r = 0; r < rays; r++)
+    {
+        hits += treeHits[r] != BVH::NO_ITEM ? 1 : 0;
+        // two boxes entered at the same distance may be reported either way round, so only the distances count
+        rayMismatches += linearDistances[r] != treeDistances[r] ? 1 : 0;
+    }
+    cout << "BVH:: rays, " << hits << " of " << rays << " hit: linear " << std::setprecision(4) << linearTime * 1000.0 << " us, tree "
+        << treeTime * 1000.0 << " us (" << std::setprecision(1) << linearTime / treeTime << "x)" << endl;
+
+    // moving placements: refit the tree for one in a hundred per frame, or build it again
+    size_t moving = std::max<size_t>(1, placements / 100);
+    start = Clock::now();
+    for (int f = 0; f < frames; f++)
+        for (size_t m = 0; m < moving; m++)
+        {
+            BVH::ItemId item = static_cast<BVH::ItemId>((m * 97 + f) % placements);
+            glm::vec3 offset(std::cos(f * 0.1f), 0.0f, std::sin(f * 0.1f));
+            items[item] = Bounds(items[item].low + offset, items[item].high + offset);
+            bvh.update(item, items[item]);
+        }
+    double refitTime = milliseconds(Clock::now() - start) / frames;
+    size_t refitMismatches = 0;
+    for (int v = 0; v < views; v++)
+    {
+        size_t linear = 0, tree = 0;
+        for (const Bounds& item : items)
+            linear += frusta[v].intersects(item.low, item.high) ? 1 : 0;
+        bvh.query(frusta[v], [&](BVH::ItemId) { tree++; });
+        refitMismatches += linear != tree ? 1 : 0;
+    }
+    start = Clock::now();
+    for (int f = 0; f < 8; f++)
+        bvh.build(items);
+    double rebuildTime = milliseconds(Clock::now() - start) / 8;
+    cout << "BVH:: " << moving << " moving per frame: refit " << std::setprecision(4) << refitTime << " ms, rebuild " << rebuildTime << " ms" << endl;
+
+    mismatches += rayMismatches + refitMismatches;
+    if (mismatches)
+        cout << "ERROR::BVH:: " << mismatches << " queries disagree with the linear pass" << endl;
+    return mismatches ? 1 : 0;
+}
+#endif
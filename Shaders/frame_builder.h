@@ -0,0 +1,62 @@
+#ifndef FRAME_BUILDER_H
+#define FRAME_BUILDER_H
+
+#include <render_queue.h>
+#include <thread_pool.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+using namespace std;
+
+// scene nodes a worker takes at a time; small enough to balance uneven nodes, large enough to keep the shared
+// counter out of the way
+#define FRAME_BUILDER_RANGE 32
+
+// Builds a frame's draw lists on a thread pool. build() has every worker, the calling thread among them, take
+// ranges of FRAME_BUILDER_RANGE nodes from a shared counter and record them into a CommandList of its own, so
+// whatever the per-node work is (occlusion tests, level of detail selection, sort keys) it runs without locks. Each
+// worker then culls and sorts its own list (see RenderQueue::finish), which leaves the GL thread to merge the lists
+// and make the API calls in RenderQueue::execute.
+class FrameBuilder
+{
+public:
+    explicit FrameBuilder(ThreadPool& pool) : pool(pool)
+    {
+    }
+
+    // the command lists RenderQueue::begin must be given for build()
+    unsigned int workers() const { return pool.size() + 1; }
+
+    // calls record(list, i) for every node i in [0, count), in ranges, on all workers; list is the worker's own
+    template <class Record>
+    void build(RenderQueue& queue, size_t count, Record record)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::atomic<size_t> next{ 0 };
+        pool.parallelFor(workers(), [&](size_t worker)
+        {
+            CommandList& list = queue.list(static_cast<unsigned int>(worker));
+            for (size_t first = next.fetch_add(FRAME_BUILDER_RANGE); first < count; first = next.fetch_add(FRAME_BUILDER_RANGE))
+                for (size_t i = first; i < std::min(count, first + FRAME_BUILDER_RANGE); i++)
+                    record(list, i);
+            queue.finish(static_cast<unsigned int>(worker));
+        });
+        nodes = count;
+        milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void report(ostream& out) const
+    {
+        out << "FRAME_BUILDER:: " << nodes << " nodes in ranges of " << FRAME_BUILDER_RANGE << " on " << workers() << " threads, "
+            << std::fixed << std::setprecision(3) << milliseconds << " ms" << endl;
+    }
+
+private:
+    ThreadPool& pool;
+    size_t nodes = 0;
+    double milliseconds = 0.0;
+};
+#endif
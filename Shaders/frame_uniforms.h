@@ -0,0 +1,87 @@
+#ifndef FRAME_UNIFORMS_H
+#define FRAME_UNIFORMS_H
+
+#include <glad/glad.h>
+#include <glm.hpp>
+
+#include <cstddef>
+
+// Per-frame values every shader needs, kept in one uniform buffer bound at FRAME_UNIFORMS_BINDING and written once
+// per frame. A shader reads them by declaring the block below; Shader connects any program that has it to the
+// binding after linking, so nothing is set per program.
+//
+//   layout (std140) uniform FrameData {
+//       mat4 view;
+//       mat4 projection;
+//       mat4 viewProjection;
+//       vec3 cameraPosition;
+//       float time;
+//       vec4 viewport;     // x, y, width, height in pixels
+//   };
+#define FRAME_UNIFORMS_BINDING 0
+#define FRAME_UNIFORMS_BLOCK "FrameData"
+
+// the std140 image of the FrameData block; a vec3 followed by a float shares one 16-byte slot
+struct FrameData {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+    glm::vec3 cameraPosition;
+    float time;
+    glm::vec4 viewport;
+};
+
+static_assert(offsetof(FrameData, cameraPosition) == 192 && offsetof(FrameData, time) == 204 &&
+    offsetof(FrameData, viewport) == 208 && sizeof(FrameData) == 224, "FrameData must match the std140 layout of the block");
+
+// connects the program's FrameData block, if it has one, to FRAME_UNIFORMS_BINDING; needed after every link or
+// binary load, as both reset block bindings
+inline void BindFrameUniforms(GLuint program)
+{
+    GLuint block = glGetUniformBlockIndex(program, FRAME_UNIFORMS_BLOCK);
+    if (block != GL_INVALID_INDEX)
+        glUniformBlockBinding(program, block, FRAME_UNIFORMS_BINDING);
+}
+
+// the buffer behind the FrameData block
+class FrameUniforms
+{
+public:
+    // needs a current context; the buffer stays bound at FRAME_UNIFORMS_BINDING from here on
+    void create()
+    {
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameData), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, buffer);
+    }
+
+    // once per frame, before the first draw
+    void update(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& cameraPosition, float time, int viewportWidth, int viewportHeight)
+    {
+        data.view = view;
+        data.projection = projection;
+        data.viewProjection = projection * view;
+        data.cameraPosition = cameraPosition;
+        data.time = time;
+        data.viewport = glm::vec4(0.0f, 0.0f, static_cast<float>(viewportWidth), static_cast<float>(viewportHeight));
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameData), &data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    // what was last written, for CPU code that needs the same matrices
+    const FrameData& current() const { return data; }
+
+    void release()
+    {
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+    }
+
+private:
+    unsigned int buffer = 0;
+    FrameData data;
+};
+#endif
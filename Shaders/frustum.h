@@ -0,0 +1,140 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm.hpp>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+using namespace std;
+
+// SSE2 is part of every x64 target, so the four-wide test needs no extra compiler flags; other targets use the
+// scalar loop
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRUSTUM_SSE2 1
+#endif
+
+// the six clip planes of a view-projection matrix, normalised, with their normals pointing inwards
+struct Frustum {
+    glm::vec4 planes[6];
+
+    // planes taken from the rows of viewProjection (Gribb and Hartmann): left, right, bottom, top, near, far
+    static Frustum FromMatrix(const glm::mat4& viewProjection)
+    {
+        glm::vec4 rows[4];
+        for (int i = 0; i < 4; i++)
+            rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+        Frustum frustum;
+        frustum.planes[0] = rows[3] + rows[0];
+        frustum.planes[1] = rows[3] - rows[0];
+        frustum.planes[2] = rows[3] + rows[1];
+        frustum.planes[3] = rows[3] - rows[1];
+        frustum.planes[4] = rows[3] + rows[2];
+        frustum.planes[5] = rows[3] - rows[2];
+        for (glm::vec4& plane : frustum.planes)
+            plane /= glm::length(glm::vec3(plane));
+        return frustum;
+    }
+
+    // false only for spheres entirely outside one of the planes, so some spheres near the corners pass
+    bool intersects(const glm::vec3& center, float radius) const
+    {
+        for (const glm::vec4& plane : planes)
+            if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+                return false;
+        return true;
+    }
+
+    bool intersects(const glm::vec3& low, const glm::vec3& high) const
+    {
+        for (const glm::vec4& plane : planes)
+        {
+            // the corner furthest along the plane's normal
+            glm::vec3 corner(plane.x >= 0.0f ? high.x : low.x, plane.y >= 0.0f ? high.y : low.y, plane.z >= 0.0f ? high.z : low.z);
+            if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    // true only for boxes entirely inside all six planes
+    bool contains(const glm::vec3& low, const glm::vec3& high) const
+    {
+        for (const glm::vec4& plane : planes)
+        {
+            // the corner furthest against the plane's normal
+            glm::vec3 corner(plane.x >= 0.0f ? low.x : high.x, plane.y >= 0.0f ? low.y : high.y, plane.z >= 0.0f ? low.z : high.z);
+            if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+};
+
+// bounding spheres as a structure of arrays, the layout the SIMD test loads four at a time
+struct SphereBounds {
+    vector<float> x, y, z, radius;
+
+    void clear()
+    {
+        x.clear();
+        y.clear();
+        z.clear();
+        radius.clear();
+    }
+
+    void push(const glm::vec3& center, float r)
+    {
+        x.push_back(center.x);
+        y.push_back(center.y);
+        z.push_back(center.z);
+        radius.push_back(r);
+    }
+
+    size_t size() const { return x.size(); }
+};
+
+// sets visible[i] to 1 for every sphere that intersects the frustum and to 0 for the others (see
+// Frustum::intersects); returns how many are visible
+inline size_t CullSpheres(const Frustum& frustum, const SphereBounds& bounds, uint8_t* visible)
+{
+    size_t count = bounds.size(), i = 0, inside = 0;
+#ifdef FRUSTUM_SSE2
+    __m128 px[6], py[6], pz[6], pw[6];
+    for (int p = 0; p < 6; p++)
+    {
+        px[p] = _mm_set1_ps(frustum.planes[p].x);
+        py[p] = _mm_set1_ps(frustum.planes[p].y);
+        pz[p] = _mm_set1_ps(frustum.planes[p].z);
+        pw[p] = _mm_set1_ps(frustum.planes[p].w);
+    }
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(&bounds.x[i]);
+        __m128 y = _mm_loadu_ps(&bounds.y[i]);
+        __m128 z = _mm_loadu_ps(&bounds.z[i]);
+        __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&bounds.radius[i]));
+        __m128 in = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int p = 0; p < 6; p++)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px[p], x), _mm_mul_ps(py[p], y)), _mm_add_ps(_mm_mul_ps(pz[p], z), pw[p]));
+            in = _mm_and_ps(in, _mm_cmpge_ps(distance, negativeRadius));
+        }
+        int mask = _mm_movemask_ps(in);
+        for (int lane = 0; lane < 4; lane++)
+        {
+            visible[i + lane] = static_cast<uint8_t>((mask >> lane) & 1);
+            inside += visible[i + lane];
+        }
+    }
+#endif
+    for (; i < count; i++)
+    {
+        visible[i] = frustum.intersects(glm::vec3(bounds.x[i], bounds.y[i], bounds.z[i]), bounds.radius[i]) ? 1 : 0;
+        inside += visible[i];
+    }
+    return inside;
+}
+#endif
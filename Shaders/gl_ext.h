@@ -0,0 +1,79 @@
+#ifndef GL_EXT_H
+#define GL_EXT_H
+
+#include <glad/glad.h>
+
+#include <cstring>
+
+// Optional entry points beyond the GL 3.3 core that glad was generated for. They are resolved at runtime
+// through the same loader glad used, and stay null when the driver doesn't expose the extension, so every
+// caller needs a 3.3 fallback.
+
+// ARB_buffer_storage (core in 4.4)
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#define GL_DYNAMIC_STORAGE_BIT 0x0100
+#define GL_CLIENT_STORAGE_BIT 0x0200
+#endif
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC_EXT)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+inline PFNGLBUFFERSTORAGEPROC_EXT glBufferStorageExt = nullptr;
+
+// ARB_get_program_binary (core in 4.1)
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+typedef void (APIENTRYP PFNGLGETPROGRAMBINARYPROC_EXT)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+typedef void (APIENTRYP PFNGLPROGRAMBINARYPROC_EXT)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+typedef void (APIENTRYP PFNGLPROGRAMPARAMETERIPROC_EXT)(GLuint program, GLenum pname, GLint value);
+
+// null unless the driver can hand out at least one binary format
+inline PFNGLGETPROGRAMBINARYPROC_EXT glGetProgramBinaryExt = nullptr;
+inline PFNGLPROGRAMBINARYPROC_EXT glProgramBinaryExt = nullptr;
+inline PFNGLPROGRAMPARAMETERIPROC_EXT glProgramParameteriExt = nullptr;
+
+// EXT_texture_compression_s3tc (BC1/BC3); BC4/BC5 are core as GL_COMPRESSED_RED_RGTC1/GL_COMPRESSED_RG_RGTC2
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// written once by LoadGLExtensions, read by texture decoding on the loader threads
+inline bool GLExtTextureCompressionS3TC = false;
+
+// true if the current context advertises the named extension
+inline bool HasGLExtension(const char* name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++)
+    {
+        const char* extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+        if (extension && std::strcmp(extension, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+// resolves the optional entry points; call once after gladLoadGLLoader with the same loader
+inline void LoadGLExtensions(GLADloadproc load)
+{
+    if (HasGLExtension("GL_ARB_buffer_storage"))
+        glBufferStorageExt = (PFNGLBUFFERSTORAGEPROC_EXT)load("glBufferStorage");
+    GLExtTextureCompressionS3TC = HasGLExtension("GL_EXT_texture_compression_s3tc");
+    if (HasGLExtension("GL_ARB_get_program_binary"))
+    {
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        if (formats > 0)
+        {
+            glGetProgramBinaryExt = (PFNGLGETPROGRAMBINARYPROC_EXT)load("glGetProgramBinary");
+            glProgramBinaryExt = (PFNGLPROGRAMBINARYPROC_EXT)load("glProgramBinary");
+            glProgramParameteriExt = (PFNGLPROGRAMPARAMETERIPROC_EXT)load("glProgramParameteri");
+        }
+    }
+}
+#endif
@@ -0,0 +1,174 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+#include <iostream>
+using namespace std;
+
+// texture units whose bindings are tracked; binds to higher units always go through
+#define GL_STATE_TEXTURE_UNITS 32
+
+// Shadow copy of the GL state the frame changes most: the program, the vertex array, the 2D and cube map
+// texture of each unit with the active unit, the depth function and blending. Every setter compares against
+// the copy and only calls GL when the value differs, counting issued and skipped calls per frame.
+//
+// Code that changes these states directly (loaders creating buffers and textures, deleting objects whose names
+// may be reused) leaves the copy stale. beginFrame() forgets the vertex array and texture bindings for that reason,
+// so it belongs after the frame's uploads and before its first draw. There is one context, hence one instance.
+class GLState
+{
+public:
+    enum Call { Program, VertexArray, ActiveTexture, Texture, DepthFunc, Blend, BlendFunc, CALL_KINDS };
+
+    struct Counts {
+        size_t issued[CALL_KINDS] = {};
+        size_t skipped[CALL_KINDS] = {};
+
+        size_t totalIssued() const { size_t n = 0; for (size_t c : issued) n += c; return n; }
+        size_t totalSkipped() const { size_t n = 0; for (size_t c : skipped) n += c; return n; }
+    };
+
+    static GLState& Instance()
+    {
+        static GLState state;
+        return state;
+    }
+
+    // keeps the finished frame's counts for lastFrame() and starts over; see above for what it forgets
+    void beginFrame()
+    {
+        finished = current;
+        current = Counts();
+        forgetBindings();
+    }
+
+    // forgets everything, for after code that changed any of the tracked state behind the cache's back
+    void invalidate()
+    {
+        forgetBindings();
+        program = UNKNOWN;
+        depthFunc = UNKNOWN;
+        blend = UNKNOWN;
+        blendSource = blendDestination = UNKNOWN;
+    }
+
+    void useProgram(GLuint id)
+    {
+        if (change(Program, program, id))
+            glUseProgram(id);
+    }
+
+    void bindVertexArray(GLuint id)
+    {
+        if (change(VertexArray, vertexArray, id))
+            glBindVertexArray(id);
+    }
+
+    void activeTexture(unsigned int unit)
+    {
+        if (change(ActiveTexture, activeUnit, unit))
+            glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    // binds id to target on unit, making unit the active one only when the binding actually changes
+    void bindTexture(unsigned int unit, GLenum target, GLuint id)
+    {
+        GLuint* bound = unit >= GL_STATE_TEXTURE_UNITS ? nullptr
+            : target == GL_TEXTURE_2D ? &texture2D[unit]
+            : target == GL_TEXTURE_CUBE_MAP ? &textureCube[unit] : nullptr;
+        if (bound && *bound == id)
+        {
+            current.skipped[Texture]++;
+            return;
+        }
+        activeTexture(unit);
+        glBindTexture(target, id);
+        current.issued[Texture]++;
+        if (bound)
+            *bound = id;
+    }
+
+    void setDepthFunc(GLenum func)
+    {
+        if (change(DepthFunc, depthFunc, func))
+            glDepthFunc(func);
+    }
+
+    void setBlend(bool enabled)
+    {
+        if (change(Blend, blend, enabled ? 1u : 0u))
+        {
+            if (enabled)
+                glEnable(GL_BLEND);
+            else
+                glDisable(GL_BLEND);
+        }
+    }
+
+    void setBlendFunc(GLenum source, GLenum destination)
+    {
+        if (blendSource == source && blendDestination == destination)
+        {
+            current.skipped[BlendFunc]++;
+            return;
+        }
+        glBlendFunc(source, destination);
+        blendSource = source;
+        blendDestination = destination;
+        current.issued[BlendFunc]++;
+    }
+
+    // counts of the frame in progress and of the one before it
+    const Counts& frame() const { return current; }
+    const Counts& lastFrame() const { return finished; }
+
+    void report(ostream& out) const
+    {
+        static const char* const names[CALL_KINDS] = { "program", "vertex array", "active texture", "texture", "depth func", "blend", "blend func" };
+        out << "GL_STATE:: " << finished.totalIssued() << " calls issued, " << finished.totalSkipped() << " skipped (";
+        for (unsigned int kind = 0; kind < CALL_KINDS; kind++)
+            out << (kind ? ", " : "") << names[kind] << ' ' << finished.issued[kind] << '/' << finished.skipped[kind];
+        out << ")" << endl;
+    }
+
+private:
+    static const GLuint UNKNOWN = 0xFFFFFFFFu;
+
+    GLuint program = UNKNOWN;
+    GLuint vertexArray = UNKNOWN;
+    GLuint activeUnit = UNKNOWN;
+    GLuint texture2D[GL_STATE_TEXTURE_UNITS];
+    GLuint textureCube[GL_STATE_TEXTURE_UNITS];
+    GLuint depthFunc = UNKNOWN;
+    GLuint blend = UNKNOWN;
+    GLuint blendSource = UNKNOWN, blendDestination = UNKNOWN;
+    Counts current, finished;
+
+    GLState()
+    {
+        invalidate();
+    }
+
+    void forgetBindings()
+    {
+        vertexArray = UNKNOWN;
+        activeUnit = UNKNOWN;
+        for (unsigned int unit = 0; unit < GL_STATE_TEXTURE_UNITS; unit++)
+            texture2D[unit] = textureCube[unit] = UNKNOWN;
+    }
+
+    // records value as the new state; false (and a skipped call) if it already was
+    bool change(Call call, GLuint& state, GLuint value)
+    {
+        if (state == value)
+        {
+            current.skipped[call]++;
+            return false;
+        }
+        state = value;
+        current.issued[call]++;
+        return true;
+    }
+};
+#endif
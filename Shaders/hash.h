@@ -0,0 +1,21 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+#define FNV1A64_OFFSET 14695981039346656037ull
+#define FNV1A64_PRIME 1099511628211ull
+
+// 64-bit FNV-1a of size bytes, continuing from hash so that several buffers can be chained into one key
+inline uint64_t Fnv1a64(const void* bytes, size_t size, uint64_t hash = FNV1A64_OFFSET)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(bytes);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= p[i];
+        hash *= FNV1A64_PRIME;
+    }
+    return hash;
+}
+#endif
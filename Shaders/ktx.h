@@ -0,0 +1,154 @@
+#ifndef KTX_H
+#define KTX_H
+
+#include <glad/glad.h>
+
+#include <gl_ext.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Minimal reader/writer for KTX 1.1 containers holding one 2D texture with a pre-built, block-compressed
+// mip chain (BC1, BC3 or BC5). Baked files sit next to their source image as "<image>.ktx".
+
+struct KtxTexture {
+    GLenum internalFormat = 0;
+    int width = 0;
+    int height = 0;
+    vector<vector<unsigned char>> levels;  // level 0 first
+};
+
+struct KtxHeader {
+    unsigned char identifier[12];
+    uint32_t endianness;
+    uint32_t glType;
+    uint32_t glTypeSize;
+    uint32_t glFormat;
+    uint32_t glInternalFormat;
+    uint32_t glBaseInternalFormat;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t numberOfArrayElements;
+    uint32_t numberOfFaces;
+    uint32_t numberOfMipmapLevels;
+    uint32_t bytesOfKeyValueData;
+};
+
+static const unsigned char KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+// bytes per 4x4 block of a supported format, 0 if the format isn't one we bake
+inline size_t KtxBlockBytes(GLenum internalFormat)
+{
+    switch (internalFormat)
+    {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return 8;
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return 16;
+    case GL_COMPRESSED_RED_RGTC1: return 8;
+    case GL_COMPRESSED_RG_RGTC2: return 16;
+    default: return 0;
+    }
+}
+
+// byte size of one mip level
+inline size_t KtxLevelBytes(GLenum internalFormat, int width, int height)
+{
+    return size_t((width + 3) / 4) * ((height + 3) / 4) * KtxBlockBytes(internalFormat);
+}
+
+// path of the baked container belonging to a source image
+inline string KtxPath(const string& imagePath)
+{
+    return imagePath + ".ktx";
+}
+
+// true if a baked container exists for imagePath and is at least as new as the image itself
+inline bool KtxIsFresh(const string& imagePath)
+{
+    std::error_code error;
+    auto baked = std::filesystem::last_write_time(KtxPath(imagePath), error);
+    if (error)
+        return false;
+    auto source = std::filesystem::last_write_time(imagePath, error);
+    return error || baked >= source;
+}
+
+inline bool WriteKtx(const string& path, const KtxTexture& texture)
+{
+    KtxHeader header;
+    memcpy(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER));
+    header.endianness = 0x04030201;
+    header.glType = 0;        // compressed: no pixel type/format
+    header.glTypeSize = 1;
+    header.glFormat = 0;
+    header.glInternalFormat = texture.internalFormat;
+    header.glBaseInternalFormat = texture.internalFormat == GL_COMPRESSED_RED_RGTC1 ? GL_RED :
+        texture.internalFormat == GL_COMPRESSED_RG_RGTC2 ? GL_RG : texture.internalFormat == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT ? GL_RGBA : GL_RGB;
+    header.pixelWidth = texture.width;
+    header.pixelHeight = texture.height;
+    header.pixelDepth = 0;
+    header.numberOfArrayElements = 0;
+    header.numberOfFaces = 1;
+    header.numberOfMipmapLevels = static_cast<uint32_t>(texture.levels.size());
+    header.bytesOfKeyValueData = 0;
+
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out)
+        return false;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const vector<unsigned char>& level : texture.levels)
+    {
+        // block sizes are multiples of 4, so no mip padding is ever needed
+        uint32_t imageSize = static_cast<uint32_t>(level.size());
+        out.write(reinterpret_cast<const char*>(&imageSize), sizeof(imageSize));
+        out.write(reinterpret_cast<const char*>(level.data()), level.size());
+    }
+    return static_cast<bool>(out);
+}
+
+// reads a container written by WriteKtx; rejects anything else (other formats, arrays, cube maps, 3D)
+inline bool ReadKtx(const string& path, KtxTexture& texture)
+{
+    ifstream in(path, ios::binary);
+    if (!in)
+        return false;
+    KtxHeader header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)))
+        return false;
+    if (memcmp(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) != 0 || header.endianness != 0x04030201 ||
+        header.glType != 0 || KtxBlockBytes(header.glInternalFormat) == 0 || header.numberOfFaces != 1 ||
+        header.pixelDepth > 1 || header.numberOfArrayElements > 0 || header.numberOfMipmapLevels == 0)
+        return false;
+    in.seekg(header.bytesOfKeyValueData, ios::cur);
+
+    texture.internalFormat = header.glInternalFormat;
+    texture.width = static_cast<int>(header.pixelWidth);
+    texture.height = static_cast<int>(header.pixelHeight);
+    texture.levels.resize(header.numberOfMipmapLevels);
+    for (uint32_t level = 0; level < header.numberOfMipmapLevels; level++)
+    {
+        int width = std::max(1, texture.width >> level);
+        int height = std::max(1, texture.height >> level);
+        uint32_t imageSize;
+        if (!in.read(reinterpret_cast<char*>(&imageSize), sizeof(imageSize)) ||
+            imageSize != KtxLevelBytes(texture.internalFormat, width, height))
+            return false;
+        texture.levels[level].resize(imageSize);
+        if (!in.read(reinterpret_cast<char*>(texture.levels[level].data()), imageSize))
+            return false;
+    }
+    return true;
+}
+
+// true if the current context can sample the given compressed format
+inline bool KtxFormatSupported(GLenum internalFormat)
+{
+    return internalFormat == GL_COMPRESSED_RED_RGTC1 || internalFormat == GL_COMPRESSED_RG_RGTC2 || GLExtTextureCompressionS3TC;
+}
+#endif
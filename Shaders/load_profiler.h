@@ -0,0 +1,267 @@
+#ifndef LOAD_PROFILER_H
+#define LOAD_PROFILER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// one timed phase of loading one asset (a model file, a texture file or a shader program)
+struct LoadEvent {
+    string asset;
+    const char* phase = "";
+    unsigned int thread = 0;        // small id in order of each thread's first event
+    double start = 0.0;             // microseconds since the profiler was created
+    double duration = 0.0;          // microseconds
+    size_t bytesRead = 0;           // file bytes read during the phase
+    size_t vertices = 0;            // vertices / triangles the phase produced
+    size_t triangles = 0;
+    size_t textureBytes = 0;        // bytes handed to GL for textures
+};
+
+// Process-wide log of where loading time goes. Every phase of every asset (hashing, import, optimisation,
+// buffer creation, image decoding, texture upload, mip generation, shader compilation...) is timed with a
+// LoadScope on whatever thread runs it. report() prints the result as a table; writeTrace() saves it in the
+// Chrome trace event format, which chrome://tracing and ui.perfetto.dev open as a per-thread timeline.
+// GL phases measure the time the driver spends in the call, not when the GPU finishes the work.
+class LoadProfiler
+{
+public:
+    static LoadProfiler& Instance()
+    {
+        static LoadProfiler profiler;
+        return profiler;
+    }
+
+    // microseconds since the profiler was created
+    double now() const
+    {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin).count();
+    }
+
+    // any thread
+    void record(LoadEvent event)
+    {
+        lock_guard<mutex> lock(eventMutex);
+        auto thread = threads.emplace(std::this_thread::get_id(), static_cast<unsigned int>(threads.size()));
+        event.thread = thread.first->second;
+        events.push_back(std::move(event));
+    }
+
+    // per-phase totals, then one row per asset with its wall-clock span (first phase start to last phase end,
+    // including time spent queued between phases), the time its phases took and what they produced
+    void report(ostream& out)
+    {
+        lock_guard<mutex> lock(eventMutex);
+        if (events.empty())
+            return;
+
+        struct PhaseTotal { size_t count = 0; double total = 0.0, longest = 0.0; string slowest; };
+        struct AssetTotal { double first = 0.0, last = 0.0, busy = 0.0; LoadEvent sums; vector<pair<string, double>> phases; };
+        vector<string> phaseOrder;
+        unordered_map<string, PhaseTotal> phases;
+        vector<string> assetOrder;
+        unordered_map<string, AssetTotal> assets;
+        double first = events.front().start, last = 0.0, busy = 0.0;
+        for (const LoadEvent& event : events)
+        {
+            first = std::min(first, event.start);
+            last = std::max(last, event.start + event.duration);
+            busy += event.duration;
+
+            if (!phases.count(event.phase))
+                phaseOrder.push_back(event.phase);
+            PhaseTotal& phase = phases[event.phase];
+            phase.count++;
+            phase.total += event.duration;
+            if (event.duration > phase.longest)
+            {
+                phase.longest = event.duration;
+                phase.slowest = event.asset;
+            }
+
+            bool seen = assets.count(event.asset) != 0;
+            AssetTotal& asset = assets[event.asset];
+            if (!seen)
+            {
+                assetOrder.push_back(event.asset);
+                asset.first = event.start;
+            }
+            asset.first = std::min(asset.first, event.start);
+            asset.last = std::max(asset.last, event.start + event.duration);
+            asset.busy += event.duration;
+            asset.sums.bytesRead += event.bytesRead;
+            asset.sums.vertices += event.vertices;
+            asset.sums.triangles += event.triangles;
+            asset.sums.textureBytes += event.textureBytes;
+            auto phaseTime = std::find_if(asset.phases.begin(), asset.phases.end(), [&](const pair<string, double>& p) { return p.first == event.phase; });
+            if (phaseTime == asset.phases.end())
+                asset.phases.emplace_back(event.phase, event.duration);
+            else
+                phaseTime->second += event.duration;
+        }
+        std::sort(assetOrder.begin(), assetOrder.end(), [&](const string& a, const string& b) { return assets[a].busy > assets[b].busy; });
+
+        out << std::fixed << std::setprecision(1);
+        out << "LOAD:: " << assets.size() << " assets in " << (last - first) / 1000.0 << " ms wall, "
+            << busy / 1000.0 << " ms of work on " << threads.size() << " threads" << endl;
+        out << "  phase        count   total ms     max ms  slowest" << endl;
+        for (const string& name : phaseOrder)
+        {
+            const PhaseTotal& phase = phases[name];
+            out << "  " << std::left << std::setw(10) << name << std::right << std::setw(8) << phase.count
+                << std::setw(11) << phase.total / 1000.0 << std::setw(11) << phase.longest / 1000.0 << "  " << displayName(phase.slowest) << endl;
+        }
+        out << "   span ms    work ms   read KiB   vertices  triangles    tex KiB  asset (phases in ms)" << endl;
+        for (const string& name : assetOrder)
+        {
+            const AssetTotal& asset = assets[name];
+            out << std::setw(10) << (asset.last - asset.first) / 1000.0 << std::setw(11) << asset.busy / 1000.0
+                << std::setw(11) << asset.sums.bytesRead / 1024.0 << std::setw(11) << asset.sums.vertices
+                << std::setw(11) << asset.sums.triangles << std::setw(11) << asset.sums.textureBytes / 1024.0
+                << "  " << displayName(name) << " (";
+            for (size_t i = 0; i < asset.phases.size(); i++)
+                out << (i ? ", " : "") << asset.phases[i].first << ' ' << asset.phases[i].second / 1000.0;
+            out << ")" << endl;
+        }
+    }
+
+    // writes every event as a complete ("X") event of a Chrome trace; returns false if the file can't be written
+    bool writeTrace(const string& path)
+    {
+        lock_guard<mutex> lock(eventMutex);
+        ofstream out(path, ios::trunc);
+        if (!out)
+        {
+            cout << "ERROR::LOAD_PROFILER::TRACE_NOT_WRITTEN: " << path << endl;
+            return false;
+        }
+        out << std::fixed << std::setprecision(3);
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        for (size_t i = 0; i < threads.size(); i++)
+            out << (i ? ",\n" : "\n") << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << i << ",\"name\":\"thread_name\",\"args\":{\"name\":\"loader thread " << i << "\"}}";
+        for (const LoadEvent& event : events)
+        {
+            string asset = displayName(event.asset);
+            string file = asset.substr(asset.find_last_of('/') + 1);
+            out << ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread << ",\"cat\":\"" << event.phase
+                << "\",\"name\":\"" << event.phase << ' ' << escape(file) << "\",\"ts\":" << event.start << ",\"dur\":" << event.duration
+                << ",\"args\":{\"asset\":\"" << escape(asset) << "\",\"bytesRead\":" << event.bytesRead << ",\"vertices\":" << event.vertices
+                << ",\"triangles\":" << event.triangles << ",\"textureBytes\":" << event.textureBytes << "}}";
+        }
+        out << "\n]}\n";
+        return static_cast<bool>(out);
+    }
+
+private:
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    mutex eventMutex;
+    vector<LoadEvent> events;
+    unordered_map<std::thread::id, unsigned int> threads;
+
+    LoadProfiler() {}
+
+    // assets are keyed by path, often absolute (see TextureRegistry::CanonicalPath); shown relative to the working directory
+    static string displayName(const string& asset)
+    {
+        std::error_code error;
+        string base = std::filesystem::current_path(error).generic_string() + '/';
+        if (!error && asset.compare(0, base.size(), base) == 0)
+            return asset.substr(base.size());
+        return asset;
+    }
+
+    static string escape(const string& text)
+    {
+        string escaped;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char code[8];
+                snprintf(code, sizeof(code), "\\u%04x", c);
+                escaped += code;
+                continue;
+            }
+            escaped += c;
+        }
+        return escaped;
+    }
+};
+
+// times one phase of one asset, from construction until end() or destruction, and records it with what
+// the caller reports it read and produced. Scopes nest per thread; CountBytesRead goes to the innermost.
+class LoadScope
+{
+public:
+    size_t bytesRead = 0;
+    size_t vertices = 0;
+    size_t triangles = 0;
+    size_t textureBytes = 0;
+
+    LoadScope(const string& asset, const char* phase) : asset(asset), phase(phase), parent(Current())
+    {
+        Current() = this;
+        start = LoadProfiler::Instance().now();
+    }
+
+    ~LoadScope()
+    {
+        end();
+    }
+
+    LoadScope(const LoadScope&) = delete;
+    LoadScope& operator=(const LoadScope&) = delete;
+
+    void end()
+    {
+        if (ended)
+            return;
+        ended = true;
+        LoadEvent event;
+        event.asset = asset;
+        event.phase = phase;
+        event.start = start;
+        event.duration = LoadProfiler::Instance().now() - start;
+        event.bytesRead = bytesRead;
+        event.vertices = vertices;
+        event.triangles = triangles;
+        event.textureBytes = textureBytes;
+        LoadProfiler::Instance().record(std::move(event));
+        Current() = parent;
+    }
+
+    // innermost open scope on the calling thread, or null
+    static LoadScope*& Current()
+    {
+        thread_local LoadScope* current = nullptr;
+        return current;
+    }
+
+private:
+    string asset;
+    const char* phase;
+    LoadScope* parent;
+    double start = 0.0;
+    bool ended = false;
+};
+
+// attributes file bytes to whatever phase is being timed on this thread; for readers that don't know the asset
+inline void CountBytesRead(size_t bytes)
+{
+    if (LoadScope* scope = LoadScope::Current())
+        scope->bytesRead += bytes;
+}
+#endif
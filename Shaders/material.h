@@ -0,0 +1,114 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include <glad/glad.h>
+
+#include <gl_state.h>
+#include <shader_s.h>
+
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+struct Texture {
+    unsigned int id;
+    string type;
+    string path;
+};
+
+// texture units per sampler type: texture_diffuseN is bound to unit N - 1, texture_specularN to 3 + N and so on,
+// so a sampler uniform points at the same unit whichever material is drawn and only needs setting once per program
+#define MATERIAL_SAMPLERS_PER_TYPE 4
+
+// The textures of a mesh, each with a fixed texture unit and its sampler name worked out once when the mesh is
+// created. Sampler locations are resolved the first time the material is bound with a given shader; from then
+// on binding it is only a GLState::bindTexture per texture, with no strings and no allocations.
+class Material
+{
+public:
+    Material() {}
+
+    explicit Material(const vector<Texture>& textures)
+    {
+        static const char* const types[] = { "texture_diffuse", "texture_specular", "texture_normal", "texture_height" };
+        unsigned int used[4] = { 0, 0, 0, 0 };
+        for (const Texture& texture : textures)
+        {
+            unsigned int type = 0;
+            while (type < 4 && texture.type != types[type])
+                type++;
+            if (type == 4 || used[type] == MATERIAL_SAMPLERS_PER_TYPE)
+            {
+                std::cout << "ERROR::MATERIAL::NO_TEXTURE_UNIT_FOR: " << texture.type << " " << texture.path << std::endl;
+                continue;
+            }
+            Slot slot;
+            slot.texture = texture.id;
+            slot.unit = type * MATERIAL_SAMPLERS_PER_TYPE + used[type];
+            // the N in texture_diffuseN counts from 1
+            slot.sampler = texture.type + std::to_string(++used[type]);
+            slots.push_back(slot);
+        }
+        id = Identify(slots);
+    }
+
+    // binds the textures to their units. The first bind with a program also points its samplers at those units,
+    // which needs that program to be in use.
+    void Bind(const Shader& shader)
+    {
+        if (slots.empty())
+            return;
+        if (!resolved(shader.ID))
+        {
+            for (const Slot& slot : slots)
+            {
+                GLint location = shader.location(slot.sampler);
+                if (location >= 0)
+                    glUniform1i(location, static_cast<GLint>(slot.unit));
+            }
+            programs.push_back(shader.ID);
+        }
+        for (const Slot& slot : slots)
+            GLState::Instance().bindTexture(slot.unit, GL_TEXTURE_2D, slot.texture);
+    }
+
+    bool empty() const { return slots.empty(); }
+
+    // equal for materials that bind the same textures to the same units, whichever meshes they belong to;
+    // 0 for a material without textures. Small and dense, so it fits the material field of a RenderQueue key.
+    unsigned int key() const { return id; }
+
+private:
+    struct Slot {
+        unsigned int texture = 0;
+        unsigned int unit = 0;
+        string sampler;
+    };
+
+    vector<Slot> slots;
+    vector<unsigned int> programs;  // programs whose samplers have been set for this material
+    unsigned int id = 0;
+
+    // numbers the distinct texture sets in order of first appearance; meshes are created on the GL thread only
+    static unsigned int Identify(const vector<Slot>& slots)
+    {
+        if (slots.empty())
+            return 0;
+        static unordered_map<string, unsigned int> ids;
+        string textures;
+        for (const Slot& slot : slots)
+            textures += std::to_string(slot.unit) + ':' + std::to_string(slot.texture) + ' ';
+        return ids.emplace(textures, static_cast<unsigned int>(ids.size() + 1)).first->second;
+    }
+
+    bool resolved(unsigned int program) const
+    {
+        for (unsigned int known : programs)
+            if (known == program)
+                return true;
+        return false;
+    }
+};
+#endif
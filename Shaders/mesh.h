@@ -6,13 +6,20 @@
 #include <glm.hpp>
 #include <gtc/matrix_transform.hpp>
 
+#include <gtc/packing.hpp>
+
 #include <shader_s.h>
+#include <material.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <string>
 #include <vector>
 using namespace std;
 
 #define MAX_BONE_INFLUENCE 4
+#define MAX_MESH_LODS 4
 
 struct Vertex {
     // position
@@ -31,19 +38,329 @@ struct Vertex {
     float m_Weights[MAX_BONE_INFLUENCE];
 };
 
-struct Texture {
-    unsigned int id;
-    string type;
-    string path;
+// Compact vertex for static meshes, 28 bytes instead of the 88 of Vertex:
+//   Position      3 x float
+//   TexCoords     2 x half float
+//   Normal        2 x snorm16, octahedral encoding
+//   TangentFrame  4 x snorm16, quaternion rotating +X/+Z onto tangent/normal; w < 0 flips the bitangent
+// Attribute locations stay those of Vertex (0 position, 1 normal, 2 uv, 3 tangent frame), so shaders that only
+// read position and uv work with either layout. Shaders that light with the packed data decode it with
+//   vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y)); n.xy += mix(vec2(max(-n.z, 0.0)), vec2(-max(-n.z, 0.0)), greaterThanEqual(n.xy, vec2(0.0))); n = normalize(n);
+//   vec3 t = vec3(1.0 - 2.0 * (q.y * q.y + q.z * q.z), 2.0 * (q.x * q.y + q.w * q.z), 2.0 * (q.x * q.z - q.w * q.y));
+//   vec3 n = vec3(2.0 * (q.x * q.z + q.w * q.y), 2.0 * (q.y * q.z - q.w * q.x), 1.0 - 2.0 * (q.x * q.x + q.y * q.y));
+//   vec3 b = cross(n, t) * sign(q.w);
+struct PackedVertex {
+    glm::vec3 Position;
+    uint16_t  TexCoords[2];
+    int16_t   Normal[2];
+    int16_t   TangentFrame[4];
+};
+
+// bone influences, kept in their own vertex stream so static meshes don't carry them; ids of -1 are unused slots
+struct VertexBones {
+    int16_t BoneIDs[MAX_BONE_INFLUENCE];
+    uint8_t Weights[MAX_BONE_INFLUENCE];   // unorm8
+};
+
+// attribute layout a Mesh is uploaded with
+enum class VertexLayout {
+    Full,       // Vertex as it is, every attribute in float and the bone slots interleaved
+    Packed      // PackedVertex, plus a VertexBones stream for skinned meshes
+};
+
+inline int16_t PackSnorm16(float value)
+{
+    return static_cast<int16_t>(std::lround(std::min(std::max(value, -1.0f), 1.0f) * 32767.0f));
+}
+
+// octahedral encoding of a unit vector into [-1, 1]^2
+inline glm::vec2 OctEncode(glm::vec3 n)
+{
+    n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    glm::vec2 e(n.x, n.y);
+    if (n.z < 0.0f)
+    {
+        e.x = (1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+        e.y = (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return e;
+}
+
+// quaternion (x, y, z, w) of the orthonormalised frame (tangent, normal x tangent, normal). w is kept away from
+// zero so that its sign survives snorm16 quantisation and carries the handedness of the original bitangent.
+inline glm::vec4 EncodeTangentFrame(glm::vec3 normal, glm::vec3 tangent, glm::vec3 bitangent)
+{
+    glm::vec3 n = glm::length(normal) > 0.0f ? glm::normalize(normal) : glm::vec3(0.0f, 0.0f, 1.0f);
+    glm::vec3 t = tangent - n * glm::dot(n, tangent);
+    if (glm::length(t) < 1e-6f)
+        t = std::abs(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) - n * n.x : glm::vec3(0.0f, 1.0f, 0.0f) - n * n.y;
+    t = glm::normalize(t);
+    glm::vec3 b = glm::cross(n, t);
+    float handedness = glm::dot(b, bitangent) < 0.0f ? -1.0f : 1.0f;
+
+    // rotation matrix with columns t, b, n
+    glm::vec4 q;
+    float trace = t.x + b.y + n.z;
+    if (trace > 0.0f)
+    {
+        float s = std::sqrt(trace + 1.0f) * 2.0f;
+        q = glm::vec4((b.z - n.y) / s, (n.x - t.z) / s, (t.y - b.x) / s, 0.25f * s);
+    }
+    else if (t.x > b.y && t.x > n.z)
+    {
+        float s = std::sqrt(1.0f + t.x - b.y - n.z) * 2.0f;
+        q = glm::vec4(0.25f * s, (b.x + t.y) / s, (n.x + t.z) / s, (b.z - n.y) / s);
+    }
+    else if (b.y > n.z)
+    {
+        float s = std::sqrt(1.0f + b.y - t.x - n.z) * 2.0f;
+        q = glm::vec4((b.x + t.y) / s, 0.25f * s, (n.y + b.z) / s, (n.x - t.z) / s);
+    }
+    else
+    {
+        float s = std::sqrt(1.0f + n.z - t.x - b.y) * 2.0f;
+        q = glm::vec4((n.x + t.z) / s, (n.y + b.z) / s, 0.25f * s, (t.y - b.x) / s);
+    }
+    q = glm::normalize(q);
+    if (q.w < 0.0f)
+        q = -q;
+
+    const float minW = 1.0f / 32767.0f;
+    if (q.w < minW)
+    {
+        float scale = std::sqrt(1.0f - minW * minW) / glm::length(glm::vec3(q));
+        q = glm::vec4(q.x * scale, q.y * scale, q.z * scale, minW);
+    }
+    return handedness < 0.0f ? -q : q;
+}
+
+inline PackedVertex PackVertex(const Vertex& vertex)
+{
+    PackedVertex packed;
+    packed.Position = vertex.Position;
+    packed.TexCoords[0] = glm::packHalf1x16(vertex.TexCoords.x);
+    packed.TexCoords[1] = glm::packHalf1x16(vertex.TexCoords.y);
+    glm::vec2 normal = glm::length(vertex.Normal) > 0.0f ? OctEncode(vertex.Normal) : glm::vec2(0.0f, 0.0f);
+    packed.Normal[0] = PackSnorm16(normal.x);
+    packed.Normal[1] = PackSnorm16(normal.y);
+    glm::vec4 frame = EncodeTangentFrame(vertex.Normal, vertex.Tangent, vertex.Bitangent);
+    for (int i = 0; i < 4; i++)
+        packed.TangentFrame[i] = PackSnorm16(frame[i]);
+    return packed;
+}
+
+// post-transform vertex cache efficiency of an index list, see AnalyzeVertexCache
+struct VertexCacheStats {
+    float acmr = 0.0f;  // average cache miss ratio: vertex shader runs per triangle
+    float atvr = 0.0f;  // average transformed vertex ratio: vertex shader runs per vertex
+};
+
+// one level of detail: a range of the mesh's index buffer drawn over the shared vertices
+struct MeshLod {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float    error;     // largest distance from the full-detail surface, in model units
+};
+
+// CPU side of a mesh, produced before any GL call is made. The arrays are either owned (fresh from
+// Assimp) or point straight into a memory-mapped mesh cache; the views always point at whichever one is in use.
+// Which views are set depends on the layout: vertexData for Full, packedData (and boneData for skinned meshes) for
+// Packed, and shortIndexData instead of indexData once the indices are 16-bit. Texture ids stay 0 until the owning
+// Model resolves them.
+struct MeshData {
+    vector<Vertex>       vertices;
+    vector<unsigned int> indices;
+    vector<Texture>      textures;
+    const Vertex*        vertexData = nullptr;
+    const unsigned int*  indexData = nullptr;
+    const PackedVertex*  packedData = nullptr;
+    const VertexBones*   boneData = nullptr;
+    const uint16_t*      shortIndexData = nullptr;
+    size_t               vertexCount = 0;
+    size_t               indexCount = 0;
+    size_t               sourceVertexCount = 0; // vertices as imported, before welding
+    VertexCacheStats     cacheBefore;           // vertex cache efficiency of the imported triangle order
+    VertexCacheStats     cacheAfter;            // and after the optimisation passes
+    vector<MeshLod>      lods;                  // level 0 first; the index arrays hold every level back to back
+    VertexLayout         layout = VertexLayout::Full;
+    vector<PackedVertex> packedVertices;    // filled by pack()
+    vector<VertexBones>  bones;             // filled by pack() for skinned meshes only
+    vector<uint16_t>     shortIndices;      // filled by narrowIndices() when every vertex fits 16 bits
+    glm::vec3            boundsMin = glm::vec3(0.0f);   // box and sphere around the vertices, filled by computeBounds()
+    glm::vec3            boundsMax = glm::vec3(0.0f);
+    glm::vec3            boundsCenter = glm::vec3(0.0f);
+    float                boundsRadius = -1.0f;          // negative until computed
+
+    // points the views at the owned vectors
+    void useOwnedArrays()
+    {
+        vertexData = vertices.data();
+        indexData = indices.data();
+        vertexCount = vertices.size();
+        indexCount = indices.size();
+    }
+
+    // model-space position and index i of whichever views are in use
+    const glm::vec3& position(size_t i) const
+    {
+        return layout == VertexLayout::Packed ? packedData[i].Position : vertexData[i].Position;
+    }
+
+    unsigned int index(size_t i) const
+    {
+        return shortIndexData ? shortIndexData[i] : indexData[i];
+    }
+
+    // converts the vertex views into the given layout; with VertexLayout::Full the views are uploaded as they are
+    void pack(VertexLayout target)
+    {
+        layout = target;
+        packedVertices.clear();
+        bones.clear();
+        packedData = nullptr;
+        boneData = nullptr;
+        if (layout != VertexLayout::Packed)
+            return;
+
+        packedVertices.resize(vertexCount);
+        bool skinned = false;
+        for (size_t i = 0; i < vertexCount; i++)
+        {
+            packedVertices[i] = PackVertex(vertexData[i]);
+            for (int j = 0; j < MAX_BONE_INFLUENCE; j++)
+                skinned = skinned || (vertexData[i].m_BoneIDs[j] >= 0 && vertexData[i].m_Weights[j] > 0.0f);
+        }
+        packedData = packedVertices.data();
+        if (!skinned)
+            return;
+
+        bones.resize(vertexCount);
+        for (size_t i = 0; i < vertexCount; i++)
+            for (int j = 0; j < MAX_BONE_INFLUENCE; j++)
+            {
+                bones[i].BoneIDs[j] = static_cast<int16_t>(vertexData[i].m_BoneIDs[j]);
+                bones[i].Weights[j] = static_cast<uint8_t>(std::lround(std::min(std::max(vertexData[i].m_Weights[j], 0.0f), 1.0f) * 255.0f));
+            }
+        boneData = bones.data();
+    }
+
+    // box around the vertices of the views, and the sphere around them centred on the box
+    void computeBounds()
+    {
+        boundsMin = boundsMax = vertexCount ? position(0) : glm::vec3(0.0f);
+        for (size_t i = 1; i < vertexCount; i++)
+        {
+            boundsMin = glm::min(boundsMin, position(i));
+            boundsMax = glm::max(boundsMax, position(i));
+        }
+        boundsCenter = (boundsMin + boundsMax) * 0.5f;
+        float radius2 = 0.0f;
+        for (size_t i = 0; i < vertexCount; i++)
+        {
+            glm::vec3 d = position(i) - boundsCenter;
+            radius2 = std::max(radius2, glm::dot(d, d));
+        }
+        boundsRadius = std::sqrt(radius2);
+    }
+
+    // copies the indices to 16 bits if the mesh has at most 65536 vertices, halving its index buffer
+    void narrowIndices()
+    {
+        shortIndices.clear();
+        shortIndexData = nullptr;
+        if (vertexCount > 65536)
+            return;
+        shortIndices.resize(indexCount);
+        for (size_t i = 0; i < indexCount; i++)
+            shortIndices[i] = static_cast<uint16_t>(indexData[i]);
+        shortIndexData = shortIndices.data();
+    }
+
+    // size of the vertex and index buffers this data uploads to
+    size_t gpuBytes() const
+    {
+        size_t vertexSize = layout == VertexLayout::Packed ? sizeof(PackedVertex) + (boneData ? sizeof(VertexBones) : 0) : sizeof(Vertex);
+        size_t indexSize = shortIndexData ? sizeof(uint16_t) : sizeof(unsigned int);
+        return vertexCount * vertexSize + indexCount * indexSize;
+    }
 };
 
+// records the attribute pointers of a buffer of Vertex (Full) or PackedVertex (Packed) bound to GL_ARRAY_BUFFER
+// in the bound vertex array
+inline void SetVertexAttributes(VertexLayout layout)
+{
+    if (layout == VertexLayout::Full)
+    {
+        // vertex Positions
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+        // vertex normals
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+        // vertex texture coords
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+        // vertex tangent
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+        // vertex bitangent
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+        // ids
+        glEnableVertexAttribArray(5);
+        glVertexAttribIPointer(5, 4, GL_INT, sizeof(Vertex), (void*)offsetof(Vertex, m_BoneIDs));
+
+        // weights
+        glEnableVertexAttribArray(6);
+        glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, m_Weights));
+    }
+    else
+    {
+        // vertex Positions
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)0);
+        // octahedral normal
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Normal));
+        // vertex texture coords, read as vec2 by the shader
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, TexCoords));
+        // tangent frame quaternion
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 4, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, TangentFrame));
+    }
+}
+
+// records the attribute pointers of a VertexBones stream bound to GL_ARRAY_BUFFER (packed layout only)
+inline void SetBoneAttributes()
+{
+    // ids
+    glEnableVertexAttribArray(5);
+    glVertexAttribIPointer(5, 4, GL_SHORT, sizeof(VertexBones), (void*)offsetof(VertexBones, BoneIDs));
+    // weights
+    glEnableVertexAttribArray(6);
+    glVertexAttribPointer(6, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(VertexBones), (void*)offsetof(VertexBones, Weights));
+}
+
 class Mesh {
 public:
     // mesh Data
     vector<Vertex>       vertices;
     vector<unsigned int> indices;
     vector<Texture>      textures;
+    Material             material;  // the textures with their units, built once from them
     unsigned int VAO;
+    unsigned int indexCount;
+    GLenum indexType = GL_UNSIGNED_INT;
+    VertexLayout layout = VertexLayout::Full;
+    vector<MeshLod> lods;   // index ranges per level of detail, level 0 being the full mesh
+    size_t bufferBytes = 0; // video memory held by the vertex and index buffers, 0 when they belong to the Model
+    GLint baseVertex = 0;           // where this mesh's vertices and indices start in the (possibly shared) buffers
+    unsigned int firstIndex = 0;
+    glm::vec3 boundsMin = glm::vec3(0.0f);      // box and sphere around the vertices, in model space (see MeshData)
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+    glm::vec3 boundsCenter = glm::vec3(0.0f);
+    float boundsRadius = -1.0f;
 
     // constructor
     Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
@@ -51,95 +368,166 @@ public:
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
+        material = Material(this->textures);
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+        setupMesh(this->vertices.data(), this->vertices.size(), this->indices.data(), this->indices.size());
     }
 
-    // render the mesh
-    void Draw(Shader& shader)
+    // uploads straight from the data's views (possibly mapped cache pages, or the arrays built by MeshData::pack
+    // and narrowIndices) without keeping a CPU copy
+    Mesh(const MeshData& data, vector<Texture> textures)
     {
-        // bind appropriate textures
-        unsigned int diffuseNr = 1;
-        unsigned int specularNr = 1;
-        unsigned int normalNr = 1;
-        unsigned int heightNr = 1;
-        for (unsigned int i = 0; i < textures.size(); i++)
+        this->textures = textures;
+        material = Material(this->textures);
+        copyBounds(data);
+        const void* indexData = data.indexData;
+        GLenum type = GL_UNSIGNED_INT;
+        if (data.shortIndexData)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-            // retrieve texture number (the N in diffuse_textureN)
-            string number;
-            string name = textures[i].type;
-            if (name == "texture_diffuse")
-                number = std::to_string(diffuseNr++);
-            else if (name == "texture_specular")
-                number = std::to_string(specularNr++); // transfer unsigned int to string
-            else if (name == "texture_normal")
-                number = std::to_string(normalNr++); // transfer unsigned int to string
-            else if (name == "texture_height")
-                number = std::to_string(heightNr++); // transfer unsigned int to string
-
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            indexData = data.shortIndexData;
+            type = GL_UNSIGNED_SHORT;
         }
+        if (data.layout == VertexLayout::Packed)
+            setupMesh(data.packedData, data.boneData, data.vertexCount, indexData, data.indexCount, type);
+        else
+            setupMesh(data.vertexData, data.vertexCount, indexData, data.indexCount, type);
+        if (!data.lods.empty())
+            lods = data.lods;
+    }
 
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+    // a view into vertex and index buffers shared with the other meshes of a Model, which owns them: vertices
+    // start at baseVertex and indices (local to the mesh) at firstIndex
+    Mesh(const MeshData& data, vector<Texture> textures, unsigned int sharedVAO, GLenum sharedIndexType, GLint baseVertex, unsigned int firstIndex)
+        : textures(textures), material(textures), VAO(sharedVAO), indexCount(static_cast<unsigned int>(data.indexCount)), indexType(sharedIndexType),
+          layout(data.layout), baseVertex(baseVertex), firstIndex(firstIndex), VBO(0), EBO(0), ownsBuffers(false)
+    {
+        if (data.lods.empty())
+            lods.assign(1, MeshLod{ 0, indexCount, 0.0f });
+        else
+            lods = data.lods;
+        copyBounds(data);
+    }
+
+    // render the mesh at the given level of detail (clamped to the coarsest one it has)
+    void Draw(Shader& shader, unsigned int lod = 0)
+    {
+        BindTextures(shader);
+        GLState::Instance().bindVertexArray(VAO);
+        DrawElements(lod);
+    }
+
+    // the index range of a level of detail, as an offset into the bound element buffer
+    const void* IndexOffset(unsigned int lod) const
+    {
+        size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int);
+        return reinterpret_cast<const void*>((firstIndex + Level(lod).firstIndex) * indexSize);
+    }
+
+    const MeshLod& Level(unsigned int lod) const
+    {
+        return lods[std::min<size_t>(lod, lods.size() - 1)];
+    }
 
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+    // issues the draw for one level of detail; the caller binds the vertex array and the textures
+    void DrawElements(unsigned int lod) const
+    {
+        glDrawElementsBaseVertex(GL_TRIANGLES, Level(lod).indexCount, indexType, IndexOffset(lod), baseVertex);
+    }
+
+    // binds the textures to their material's units (see Material::Bind); shader must be in use
+    void BindTextures(Shader& shader)
+    {
+        material.Bind(shader);
+    }
+
+    // deletes the vertex array and its buffers unless they are shared; the textures belong to the Model
+    void Release()
+    {
+        if (!ownsBuffers)
+        {
+            VAO = 0;
+            return;
+        }
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+        if (boneVBO)
+            glDeleteBuffers(1, &boneVBO);
+        VAO = VBO = EBO = boneVBO = 0;
+        bufferBytes = 0;
     }
 
 private:
     // render data 
     unsigned int VBO, EBO;
+    unsigned int boneVBO = 0;
+    bool ownsBuffers = true;
 
-    // initializes all the buffer objects/arrays
-    void setupMesh()
+    void copyBounds(const MeshData& data)
     {
+        boundsMin = data.boundsMin;
+        boundsMax = data.boundsMax;
+        boundsCenter = data.boundsCenter;
+        boundsRadius = data.boundsRadius;
+    }
+
+    // creates the vertex array and fills its index buffer (GL_UNSIGNED_INT or GL_UNSIGNED_SHORT); leaves the VAO bound
+    void createBuffers(const void* indexData, size_t count, GLenum type)
+    {
+        indexCount = static_cast<unsigned int>(count);
+        indexType = type;
+        lods.assign(1, MeshLod{ 0, indexCount, 0.0f });
+
         // create buffers/arrays
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
         glGenBuffers(1, &EBO);
 
         glBindVertexArray(VAO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        bufferBytes = count * (type == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int));
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, bufferBytes, indexData, GL_STATIC_DRAW);
+    }
+
+    // initializes all the buffer objects/arrays
+    void setupMesh(const Vertex* vertexData, size_t vertexCount, const void* indexData, size_t count, GLenum type = GL_UNSIGNED_INT)
+    {
+        layout = VertexLayout::Full;
+        createBuffers(indexData, count, type);
+
         // load data into vertex buffers
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
         // A great thing about structs is that their memory layout is sequential for all its items.
         // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
         // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertexData, GL_STATIC_DRAW);
+        bufferBytes += vertexCount * sizeof(Vertex);
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        SetVertexAttributes(VertexLayout::Full);
+        glBindVertexArray(0);
+    }
 
-        // set the vertex attribute pointers
-        // vertex Positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        // vertex tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-        // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
-        // ids
-        glEnableVertexAttribArray(5);
-        glVertexAttribIPointer(5, 4, GL_INT, sizeof(Vertex), (void*)offsetof(Vertex, m_BoneIDs));
+    // packed layout; bones is null for static meshes, which then get no bone attributes at all
+    void setupMesh(const PackedVertex* vertexData, const VertexBones* bones, size_t vertexCount, const void* indexData, size_t count, GLenum type)
+    {
+        layout = VertexLayout::Packed;
+        createBuffers(indexData, count, type);
 
-        // weights
-        glEnableVertexAttribArray(6);
-        glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, m_Weights));
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(PackedVertex), vertexData, GL_STATIC_DRAW);
+        bufferBytes += vertexCount * sizeof(PackedVertex);
+
+        SetVertexAttributes(VertexLayout::Packed);
+
+        if (bones)
+        {
+            glGenBuffers(1, &boneVBO);
+            glBindBuffer(GL_ARRAY_BUFFER, boneVBO);
+            glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(VertexBones), bones, GL_STATIC_DRAW);
+            bufferBytes += vertexCount * sizeof(VertexBones);
+            SetBoneAttributes();
+        }
         glBindVertexArray(0);
     }
 };
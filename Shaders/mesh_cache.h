@@ -0,0 +1,369 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <hash.h>
+#include <mesh.h>
+#include <mapped_file.h>
+#include <load_profiler.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Binary cache of post-processed mesh data, written next to the source asset as "<asset>.meshcache".
+// The arrays are stored exactly as they are uploaded: in the vertex layout the model was read with (see
+// MeshData::pack), with the bone stream of skinned packed meshes and with 16-bit indices where they were narrowed.
+// A warm start maps the file and hands the vertex/index pages directly to glBufferData, so neither Assimp nor the
+// packing passes run.
+//
+// layout (all offsets from the start of the file, arrays aligned to MESH_CACHE_ALIGNMENT):
+//   MeshCacheHeader
+//   MeshCacheEntry[meshCount]
+//   texture records: per texture  u16 typeLength, type bytes, u16 pathLength, path bytes
+//   vertex, bone and index arrays
+#define MESH_CACHE_MAGIC 0x434D4B50u // "PKMC"
+#define MESH_CACHE_VERSION 8u
+#define MESH_CACHE_ALIGNMENT 16u
+
+struct MeshCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sourceHash;    // hash of the asset, its material libraries, the import flags and the vertex layout
+    uint32_t layout;        // VertexLayout of the vertex arrays
+    uint32_t vertexSize;    // sizeof(Vertex) or sizeof(PackedVertex) at write time; a struct change invalidates the cache
+    uint32_t meshCount;
+    float boundsMin[3];     // box around every vertex of every mesh, readable without loading them (see ReadBounds)
+    float boundsMax[3];
+};
+
+struct MeshCacheEntry {
+    uint64_t vertexOffset;
+    uint64_t boneOffset;            // VertexBones array of a skinned packed mesh, 0 if it has none
+    uint64_t indexOffset;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t indexSize;             // 2 or 4 bytes
+    uint32_t textureCount;
+    uint32_t sourceVertexCount;     // vertices as imported, before welding
+    VertexCacheStats cacheBefore;   // kept so warm starts can still report what the optimiser did
+    VertexCacheStats cacheAfter;
+    uint32_t lodCount;
+    MeshLod lods[MAX_MESH_LODS];
+    float boundsMin[3];             // MeshData's box and sphere, so warm starts don't scan the vertices for them
+    float boundsMax[3];
+    float boundsCenter[3];
+    float boundsRadius;
+};
+
+class MeshCache
+{
+public:
+    // path of the cache file belonging to an asset
+    static string CachePath(const string& assetPath)
+    {
+        return assetPath + ".meshcache";
+    }
+
+    // hashes the asset file together with every material library it references, so editing either
+    // one (or changing the importer flags or the vertex layout) produces a different key
+    static uint64_t HashSource(const string& assetPath, unsigned int importFlags, VertexLayout layout)
+    {
+        uint32_t salt[3] = { MESH_CACHE_VERSION, importFlags, static_cast<uint32_t>(layout) };
+        uint64_t hash = Fnv1a64(salt, sizeof(salt));
+
+        MappedFile source(assetPath);
+        if (!source.isOpen())
+            return 0;
+        hash = Fnv1a64(source.data(), source.size(), hash);
+        CountBytesRead(source.size());
+
+        string directory = assetPath.substr(0, assetPath.find_last_of('/'));
+        for (const string& library : materialLibraries(source))
+        {
+            MappedFile mtl(directory + '/' + library);
+            if (mtl.isOpen())
+            {
+                hash = Fnv1a64(mtl.data(), mtl.size(), hash);
+                CountBytesRead(mtl.size());
+            }
+        }
+        return hash;
+    }
+
+    // maps the cache for assetPath and fills meshes with views into it, in the given layout. The mapping is moved
+    // into storage, which must outlive every use of the returned views (i.e. the GL upload).
+    static bool Load(const string& assetPath, uint64_t sourceHash, VertexLayout layout, vector<MeshData>& meshes, MappedFile& storage)
+    {
+        MappedFile file(CachePath(assetPath));
+        if (!file.isOpen() || file.size() < sizeof(MeshCacheHeader))
+            return false;
+
+        const unsigned char* base = file.data();
+        MeshCacheHeader header;
+        memcpy(&header, base, sizeof(header));
+        if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION || header.layout != static_cast<uint32_t>(layout) ||
+            header.vertexSize != vertexSize(layout) || header.sourceHash != sourceHash)
+            return false;
+
+        size_t cursor = sizeof(MeshCacheHeader);
+        if (cursor + header.meshCount * sizeof(MeshCacheEntry) > file.size())
+            return false;
+        vector<MeshCacheEntry> entries(header.meshCount);
+        if (header.meshCount > 0)
+            memcpy(entries.data(), base + cursor, header.meshCount * sizeof(MeshCacheEntry));
+        cursor += header.meshCount * sizeof(MeshCacheEntry);
+
+        vector<MeshData> loaded(header.meshCount);
+        for (uint32_t m = 0; m < header.meshCount; m++)
+        {
+            const MeshCacheEntry& entry = entries[m];
+            MeshData& data = loaded[m];
+            for (uint32_t t = 0; t < entry.textureCount; t++)
+            {
+                Texture texture;
+                texture.id = 0;
+                if (!readString(file, cursor, texture.type) || !readString(file, cursor, texture.path))
+                    return false;
+                data.textures.push_back(texture);
+            }
+
+            uint64_t vertexBytes = uint64_t(entry.vertexCount) * header.vertexSize;
+            uint64_t boneBytes = uint64_t(entry.vertexCount) * sizeof(VertexBones);
+            uint64_t indexBytes = uint64_t(entry.indexCount) * entry.indexSize;
+            if ((entry.indexSize != sizeof(uint16_t) && entry.indexSize != sizeof(unsigned int)) ||
+                entry.vertexOffset + vertexBytes > file.size() || entry.indexOffset + indexBytes > file.size() ||
+                (entry.boneOffset && (layout != VertexLayout::Packed || entry.boneOffset + boneBytes > file.size())))
+                return false;
+            data.layout = layout;
+            if (layout == VertexLayout::Packed)
+                data.packedData = reinterpret_cast<const PackedVertex*>(base + entry.vertexOffset);
+            else
+                data.vertexData = reinterpret_cast<const Vertex*>(base + entry.vertexOffset);
+            if (entry.boneOffset)
+                data.boneData = reinterpret_cast<const VertexBones*>(base + entry.boneOffset);
+            if (entry.indexSize == sizeof(uint16_t))
+                data.shortIndexData = reinterpret_cast<const uint16_t*>(base + entry.indexOffset);
+            else
+                data.indexData = reinterpret_cast<const unsigned int*>(base + entry.indexOffset);
+            data.vertexCount = entry.vertexCount;
+            data.indexCount = entry.indexCount;
+            data.sourceVertexCount = entry.sourceVertexCount;
+            data.cacheBefore = entry.cacheBefore;
+            data.cacheAfter = entry.cacheAfter;
+            data.boundsMin = glm::vec3(entry.boundsMin[0], entry.boundsMin[1], entry.boundsMin[2]);
+            data.boundsMax = glm::vec3(entry.boundsMax[0], entry.boundsMax[1], entry.boundsMax[2]);
+            data.boundsCenter = glm::vec3(entry.boundsCenter[0], entry.boundsCenter[1], entry.boundsCenter[2]);
+            data.boundsRadius = entry.boundsRadius;
+            if (entry.lodCount > MAX_MESH_LODS)
+                return false;
+            data.lods.assign(entry.lods, entry.lods + entry.lodCount);
+            for (const MeshLod& lod : data.lods)
+                if (uint64_t(lod.firstIndex) + lod.indexCount > entry.indexCount)
+                    return false;
+        }
+
+        meshes = std::move(loaded);
+        CountBytesRead(file.size());
+        storage = std::move(file);
+        return true;
+    }
+
+    // reads only the bounding box stored in the cache header. The source hash isn't checked, so the box may
+    // belong to an older version of the asset; good enough for a placeholder, not for culling.
+    static bool ReadBounds(const string& assetPath, glm::vec3& low, glm::vec3& high)
+    {
+        ifstream in(CachePath(assetPath), ios::binary);
+        MeshCacheHeader header;
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != MESH_CACHE_MAGIC ||
+            header.version != MESH_CACHE_VERSION || header.meshCount == 0)
+            return false;
+        low = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+        high = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+        return true;
+    }
+
+    // writes the cache for assetPath from meshes packed into the layout sourceHash was computed for, with their
+    // bounds computed; goes through a temporary file so a crash never leaves a torn cache behind
+    static bool Store(const string& assetPath, uint64_t sourceHash, const vector<MeshData>& meshes)
+    {
+        if (sourceHash == 0)
+            return false;
+        VertexLayout layout = meshes.empty() ? VertexLayout::Full : meshes[0].layout;
+
+        MeshCacheHeader header;
+        header.magic = MESH_CACHE_MAGIC;
+        header.version = MESH_CACHE_VERSION;
+        header.sourceHash = sourceHash;
+        header.layout = static_cast<uint32_t>(layout);
+        header.vertexSize = vertexSize(layout);
+        header.meshCount = static_cast<uint32_t>(meshes.size());
+        glm::vec3 low(0.0f), high(0.0f);
+        bool first = true;
+        for (const MeshData& data : meshes)
+            if (data.vertexCount)
+            {
+                low = first ? data.boundsMin : glm::min(low, data.boundsMin);
+                high = first ? data.boundsMax : glm::max(high, data.boundsMax);
+                first = false;
+            }
+        memcpy(header.boundsMin, &low[0], sizeof(header.boundsMin));
+        memcpy(header.boundsMax, &high[0], sizeof(header.boundsMax));
+
+        // texture records go right after the entry table, the arrays after that
+        vector<char> strings;
+        for (const MeshData& data : meshes)
+            for (const Texture& texture : data.textures)
+            {
+                appendString(strings, texture.type);
+                appendString(strings, texture.path);
+            }
+
+        vector<MeshCacheEntry> entries(meshes.size());
+        uint64_t cursor = align(sizeof(MeshCacheHeader) + entries.size() * sizeof(MeshCacheEntry) + strings.size());
+        for (size_t m = 0; m < meshes.size(); m++)
+        {
+            const MeshData& data = meshes[m];
+            MeshCacheEntry& entry = entries[m];
+            entry.vertexCount = static_cast<uint32_t>(data.vertexCount);
+            entry.indexCount = static_cast<uint32_t>(data.indexCount);
+            entry.indexSize = data.shortIndexData ? sizeof(uint16_t) : sizeof(unsigned int);
+            entry.textureCount = static_cast<uint32_t>(data.textures.size());
+            entry.sourceVertexCount = static_cast<uint32_t>(data.sourceVertexCount);
+            entry.cacheBefore = data.cacheBefore;
+            entry.cacheAfter = data.cacheAfter;
+            entry.lodCount = static_cast<uint32_t>(std::min<size_t>(data.lods.size(), MAX_MESH_LODS));
+            memset(entry.lods, 0, sizeof(entry.lods));
+            std::copy(data.lods.begin(), data.lods.begin() + entry.lodCount, entry.lods);
+            memcpy(entry.boundsMin, &data.boundsMin[0], sizeof(entry.boundsMin));
+            memcpy(entry.boundsMax, &data.boundsMax[0], sizeof(entry.boundsMax));
+            memcpy(entry.boundsCenter, &data.boundsCenter[0], sizeof(entry.boundsCenter));
+            entry.boundsRadius = data.boundsRadius;
+            entry.vertexOffset = cursor;
+            cursor = align(cursor + data.vertexCount * header.vertexSize);
+            entry.boneOffset = 0;
+            if (data.boneData)
+            {
+                entry.boneOffset = cursor;
+                cursor = align(cursor + data.vertexCount * sizeof(VertexBones));
+            }
+            entry.indexOffset = cursor;
+            cursor = align(cursor + data.indexCount * entry.indexSize);
+        }
+
+        string finalPath = CachePath(assetPath);
+        string tempPath = finalPath + ".tmp";
+        ofstream out(tempPath, ios::binary | ios::trunc);
+        if (!out)
+            return false;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        if (!entries.empty())
+            out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(MeshCacheEntry));
+        if (!strings.empty())
+            out.write(strings.data(), strings.size());
+        for (size_t m = 0; m < meshes.size(); m++)
+        {
+            const MeshData& data = meshes[m];
+            const void* vertices = layout == VertexLayout::Packed ? static_cast<const void*>(data.packedData) : data.vertexData;
+            const void* indices = data.shortIndexData ? static_cast<const void*>(data.shortIndexData) : data.indexData;
+            pad(out, entries[m].vertexOffset);
+            out.write(static_cast<const char*>(vertices), data.vertexCount * header.vertexSize);
+            if (entries[m].boneOffset)
+            {
+                pad(out, entries[m].boneOffset);
+                out.write(reinterpret_cast<const char*>(data.boneData), data.vertexCount * sizeof(VertexBones));
+            }
+            pad(out, entries[m].indexOffset);
+            out.write(static_cast<const char*>(indices), data.indexCount * entries[m].indexSize);
+        }
+        pad(out, cursor);
+        out.close();
+        if (!out)
+        {
+            std::remove(tempPath.c_str());
+            return false;
+        }
+
+        std::remove(finalPath.c_str()); // rename doesn't replace an existing file on Windows
+        if (std::rename(tempPath.c_str(), finalPath.c_str()) != 0)
+        {
+            std::cout << "ERROR::MESH_CACHE:: could not write " << finalPath << std::endl;
+            std::remove(tempPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static uint32_t vertexSize(VertexLayout layout)
+    {
+        return layout == VertexLayout::Packed ? sizeof(PackedVertex) : sizeof(Vertex);
+    }
+
+    static uint64_t align(uint64_t offset)
+    {
+        return (offset + MESH_CACHE_ALIGNMENT - 1) & ~uint64_t(MESH_CACHE_ALIGNMENT - 1);
+    }
+
+    // collects the file names of all 'mtllib' statements in an OBJ file
+    static vector<string> materialLibraries(const MappedFile& source)
+    {
+        vector<string> libraries;
+        const char* text = reinterpret_cast<const char*>(source.data());
+        size_t size = source.size();
+        size_t lineStart = 0;
+        while (lineStart < size)
+        {
+            size_t lineEnd = lineStart;
+            while (lineEnd < size && text[lineEnd] != '\n')
+                lineEnd++;
+            if (lineEnd - lineStart > 7 && strncmp(text + lineStart, "mtllib", 6) == 0 &&
+                (text[lineStart + 6] == ' ' || text[lineStart + 6] == '\t'))
+            {
+                string name(text + lineStart + 7, lineEnd - lineStart - 7);
+                while (!name.empty() && (name.back() == '\r' || name.back() == ' ' || name.back() == '\t'))
+                    name.pop_back();
+                size_t first = name.find_first_not_of(" \t");
+                if (first != string::npos)
+                    libraries.push_back(name.substr(first));
+            }
+            lineStart = lineEnd + 1;
+        }
+        return libraries;
+    }
+
+    static void appendString(vector<char>& blob, const string& value)
+    {
+        uint16_t length = static_cast<uint16_t>(value.size());
+        blob.insert(blob.end(), reinterpret_cast<const char*>(&length), reinterpret_cast<const char*>(&length) + sizeof(length));
+        blob.insert(blob.end(), value.begin(), value.begin() + length);
+    }
+
+    static bool readString(const MappedFile& file, size_t& cursor, string& value)
+    {
+        uint16_t length;
+        if (cursor + sizeof(length) > file.size())
+            return false;
+        memcpy(&length, file.data() + cursor, sizeof(length));
+        cursor += sizeof(length);
+        if (cursor + length > file.size())
+            return false;
+        value.assign(reinterpret_cast<const char*>(file.data() + cursor), length);
+        cursor += length;
+        return true;
+    }
+
+    static void pad(ofstream& out, uint64_t offset)
+    {
+        static const char zeros[MESH_CACHE_ALIGNMENT] = {};
+        uint64_t position = static_cast<uint64_t>(out.tellp());
+        if (offset > position)
+            out.write(zeros, static_cast<std::streamsize>(offset - position));
+    }
+};
+#endif
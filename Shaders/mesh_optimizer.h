@@ -0,0 +1,556 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <mesh.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// Load-time passes over indexed triangle lists. They run on the loader threads before a mesh is cached,
+// so they touch no GL state and their cost is only paid on a cold start.
+
+// hash of every byte of a vertex (position, normal, uv, tangent frame and bone slots)
+inline uint32_t HashVertex(const Vertex& vertex)
+{
+    uint32_t words[sizeof(Vertex) / sizeof(uint32_t)];
+    memcpy(words, &vertex, sizeof(words));
+    uint32_t hash = 2166136261u;
+    for (uint32_t word : words)
+    {
+        hash ^= word;
+        hash *= 16777619u;
+        hash ^= hash >> 15;
+    }
+    return hash;
+}
+
+// merges vertices whose attributes are bit-identical and rewrites indices to match. Unique vertices keep their
+// first-seen order; returns how many remain.
+inline size_t WeldVertices(vector<Vertex>& vertices, vector<unsigned int>& indices)
+{
+    static_assert(sizeof(Vertex) % sizeof(uint32_t) == 0, "Vertex must have no tail padding to be hashed word by word");
+    const unsigned int empty = ~0u;
+
+    size_t tableSize = 1;
+    while (tableSize < vertices.size() * 2)
+        tableSize *= 2;
+    vector<unsigned int> table(tableSize, empty);
+    vector<unsigned int> remap(vertices.size());
+
+    // unique vertices are compacted towards the front as they are found, so every table entry refers to a
+    // slot that has already been written
+    unsigned int unique = 0;
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        size_t slot = HashVertex(vertices[i]) & (tableSize - 1);
+        while (table[slot] != empty && memcmp(&vertices[table[slot]], &vertices[i], sizeof(Vertex)) != 0)
+            slot = (slot + 1) & (tableSize - 1); // linear probing
+        if (table[slot] == empty)
+        {
+            table[slot] = unique;
+            vertices[unique++] = vertices[i];
+        }
+        remap[i] = table[slot];
+    }
+
+    vertices.resize(unique);
+    for (unsigned int& index : indices)
+        index = remap[index];
+    return unique;
+}
+
+// runs an index list through a FIFO post-transform cache of cacheSize entries. ACMR is misses per triangle
+// (0.5 is the ideal for a regular grid, 3 the worst case), ATVR misses per vertex (1 is ideal).
+inline VertexCacheStats AnalyzeVertexCache(const unsigned int* indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize = 16)
+{
+    // a vertex is cached if it entered the FIFO less than cacheSize insertions ago
+    vector<unsigned int> entered(vertexCount, 0);
+    unsigned int time = cacheSize + 1;
+    size_t misses = 0;
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        unsigned int vertex = indices[i];
+        if (time - entered[vertex] > cacheSize)
+        {
+            entered[vertex] = time++;
+            misses++;
+        }
+    }
+
+    VertexCacheStats stats;
+    size_t triangles = indexCount / 3;
+    stats.acmr = triangles ? float(misses) / triangles : 0.0f;
+    stats.atvr = vertexCount ? float(misses) / vertexCount : 0.0f;
+    return stats;
+}
+
+// Forsyth's linear-speed vertex cache optimisation: triangles are emitted greedily by the score of their
+// vertices, which favours vertices recently used (their position in a simulated LRU cache) and vertices with
+// few triangles left (so strips get finished instead of leaving stragglers behind).
+inline void OptimizeVertexCache(unsigned int* indices, size_t indexCount, size_t vertexCount)
+{
+    const int cacheSize = 32;
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+        return;
+
+    // triangles using each vertex, as one array sliced by firstTriangle/liveTriangles
+    vector<unsigned int> liveTriangles(vertexCount, 0);
+    for (size_t i = 0; i < triangleCount * 3; i++)
+        liveTriangles[indices[i]]++;
+    vector<unsigned int> firstTriangle(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++)
+        firstTriangle[v + 1] = firstTriangle[v] + liveTriangles[v];
+    vector<unsigned int> adjacency(triangleCount * 3);
+    vector<unsigned int> filled(firstTriangle.begin(), firstTriangle.end() - 1);
+    for (size_t t = 0; t < triangleCount; t++)
+        for (int k = 0; k < 3; k++)
+            adjacency[filled[indices[t * 3 + k]]++] = static_cast<unsigned int>(t);
+
+    auto vertexScore = [&](int cachePosition, unsigned int live) -> float
+    {
+        if (live == 0)
+            return -1.0f; // no triangles left, never worth picking
+        float score = 0.0f;
+        if (cachePosition >= 0)
+            score = cachePosition < 3 ? 0.75f : std::pow(1.0f - float(cachePosition - 3) / (cacheSize - 3), 1.5f);
+        return score + 2.0f / std::sqrt(float(live));
+    };
+
+    vector<int> cachePosition(vertexCount, -1);
+    vector<float> scores(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+        scores[v] = vertexScore(-1, liveTriangles[v]);
+    vector<float> triangleScores(triangleCount);
+    vector<bool> emitted(triangleCount, false);
+    int best = 0;
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        triangleScores[t] = scores[indices[t * 3]] + scores[indices[t * 3 + 1]] + scores[indices[t * 3 + 2]];
+        if (triangleScores[t] > triangleScores[best])
+            best = static_cast<int>(t);
+    }
+
+    vector<unsigned int> output;
+    output.reserve(triangleCount * 3);
+    vector<unsigned int> cache, nextCache;
+    size_t cursor = 0;
+    while (output.size() < triangleCount * 3)
+    {
+        if (best < 0)
+        {
+            // nothing in the cache has triangles left: restart at the next unemitted triangle
+            while (emitted[cursor])
+                cursor++;
+            best = static_cast<int>(cursor);
+        }
+
+        const unsigned int* triangle = indices + best * 3;
+        emitted[best] = true;
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int vertex = triangle[k];
+            output.push_back(vertex);
+            // drop the triangle from the vertex's live list
+            unsigned int* begin = adjacency.data() + firstTriangle[vertex];
+            unsigned int* end = begin + liveTriangles[vertex];
+            *std::find(begin, end, static_cast<unsigned int>(best)) = *(end - 1);
+            liveTriangles[vertex]--;
+        }
+
+        // the triangle's vertices move to the front of the LRU cache; entries pushed past cacheSize fall out
+        nextCache.assign(triangle, triangle + 3);
+        for (unsigned int vertex : cache)
+            if (vertex != triangle[0] && vertex != triangle[1] && vertex != triangle[2])
+                nextCache.push_back(vertex);
+        for (size_t i = 0; i < nextCache.size(); i++)
+        {
+            unsigned int vertex = nextCache[i];
+            cachePosition[vertex] = i < size_t(cacheSize) ? static_cast<int>(i) : -1;
+            scores[vertex] = vertexScore(cachePosition[vertex], liveTriangles[vertex]);
+        }
+
+        // rescore the triangles around every vertex that changed and pick the best one
+        best = -1;
+        float bestScore = 0.0f;
+        for (unsigned int vertex : nextCache)
+            for (unsigned int j = 0; j < liveTriangles[vertex]; j++)
+            {
+                unsigned int t = adjacency[firstTriangle[vertex] + j];
+                triangleScores[t] = scores[indices[t * 3]] + scores[indices[t * 3 + 1]] + scores[indices[t * 3 + 2]];
+                if (best < 0 || triangleScores[t] > bestScore)
+                {
+                    best = static_cast<int>(t);
+                    bestScore = triangleScores[t];
+                }
+            }
+
+        if (nextCache.size() > size_t(cacheSize))
+            nextCache.resize(cacheSize);
+        cache.swap(nextCache);
+    }
+    std::copy(output.begin(), output.end(), indices);
+}
+
+// Reorders the clusters of a cache-optimised index list so that triangles facing away from the mesh centre are
+// drawn first; they tend to occlude the rest, so fewer fragments get shaded twice. A cluster ends where the
+// cache restarts (a triangle with three misses) or, once its own ACMR is within threshold of the mesh's, where
+// the next triangle has two misses, so reordering clusters costs little of the cache locality.
+inline void OptimizeOverdraw(unsigned int* indices, size_t indexCount, const Vertex* vertices, size_t vertexCount, float threshold = 1.05f)
+{
+    const unsigned int cacheSize = 16;
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount < 2)
+        return;
+
+    // misses of each triangle in the same FIFO model AnalyzeVertexCache uses
+    vector<unsigned int> entered(vertexCount, 0);
+    vector<unsigned char> misses(triangleCount, 0);
+    unsigned int time = cacheSize + 1;
+    size_t totalMisses = 0;
+    for (size_t t = 0; t < triangleCount; t++)
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int vertex = indices[t * 3 + k];
+            if (time - entered[vertex] > cacheSize)
+            {
+                entered[vertex] = time++;
+                misses[t]++;
+                totalMisses++;
+            }
+        }
+    float meshAcmr = float(totalMisses) / triangleCount;
+
+    vector<size_t> clusterStarts(1, 0);
+    size_t clusterMisses = misses[0];
+    for (size_t t = 1; t < triangleCount; t++)
+    {
+        float clusterAcmr = float(clusterMisses) / (t - clusterStarts.back());
+        if (misses[t] == 3 || (misses[t] == 2 && clusterAcmr <= meshAcmr * threshold))
+        {
+            clusterStarts.push_back(t);
+            clusterMisses = 0;
+        }
+        clusterMisses += misses[t];
+    }
+    if (clusterStarts.size() < 2)
+        return;
+    clusterStarts.push_back(triangleCount);
+
+    // area-weighted centroid of the whole mesh, then each cluster's centroid and average normal
+    struct Cluster {
+        size_t start, end;
+        float key;
+    };
+    vector<Cluster> clusters(clusterStarts.size() - 1);
+    vector<glm::vec3> centroids(clusters.size()), normals(clusters.size());
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+    for (size_t c = 0; c < clusters.size(); c++)
+    {
+        clusters[c].start = clusterStarts[c];
+        clusters[c].end = clusterStarts[c + 1];
+        glm::vec3 centroid(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = clusters[c].start; t < clusters[c].end; t++)
+        {
+            const glm::vec3& a = vertices[indices[t * 3]].Position;
+            const glm::vec3& b = vertices[indices[t * 3 + 1]].Position;
+            const glm::vec3& d = vertices[indices[t * 3 + 2]].Position;
+            glm::vec3 cross = glm::cross(b - a, d - a);
+            float twiceArea = glm::length(cross);
+            centroid += (a + b + d) * (twiceArea / 3.0f);
+            normal += cross;
+            area += twiceArea;
+        }
+        meshCentroid += centroid;
+        meshArea += area;
+        centroids[c] = area > 0.0f ? centroid / area : vertices[indices[clusters[c].start * 3]].Position;
+        normals[c] = glm::length(normal) > 0.0f ? glm::normalize(normal) : glm::vec3(0.0f);
+    }
+    if (meshArea > 0.0f)
+        meshCentroid /= meshArea;
+    for (size_t c = 0; c < clusters.size(); c++)
+        clusters[c].key = glm::dot(centroids[c] - meshCentroid, normals[c]);
+
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.key > b.key; });
+    vector<unsigned int> output;
+    output.reserve(triangleCount * 3);
+    for (const Cluster& cluster : clusters)
+        output.insert(output.end(), indices + cluster.start * 3, indices + cluster.end * 3);
+    std::copy(output.begin(), output.end(), indices);
+}
+
+// symmetric 4x4 error quadric of Garland and Heckbert: the sum of squared distances to a set of planes
+struct Quadric {
+    double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0;
+
+    void addPlane(double a, double b, double c, double d)
+    {
+        a2 += a * a; ab += a * b; ac += a * c; ad += a * d;
+        b2 += b * b; bc += b * c; bd += b * d;
+        c2 += c * c; cd += c * d;
+        d2 += d * d;
+    }
+
+    void add(const Quadric& q)
+    {
+        a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+        b2 += q.b2; bc += q.bc; bd += q.bd;
+        c2 += q.c2; cd += q.cd;
+        d2 += q.d2;
+    }
+
+    double error(const glm::vec3& p) const
+    {
+        double x = p.x, y = p.y, z = p.z;
+        double e = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+                 + b2 * y * y + 2 * bc * y * z + 2 * bd * y
+                 + c2 * z * z + 2 * cd * z
+                 + d2;
+        return e > 0 ? e : 0;
+    }
+};
+
+// Quadric error metric simplification by edge collapse onto existing vertices, so the result is an index list
+// over the unchanged vertex buffer. Collapses are applied cheapest first in passes until the index list is down
+// to targetIndexCount or the next one would move the surface by more than maxError. Vertices on open borders and
+// on attribute seams (several vertices at one position) never move, so LODs don't crack or smear UVs. error is
+// set to the largest deviation accepted, in model units.
+inline vector<unsigned int> SimplifyIndices(const Vertex* vertices, size_t vertexCount, const unsigned int* source, size_t indexCount,
+                                            size_t targetIndexCount, float maxError, float& error)
+{
+    vector<unsigned int> indices(source, source + indexCount - indexCount % 3);
+    error = 0.0f;
+
+    // vertices sharing a position are the same point of the surface
+    struct PositionHash {
+        size_t operator()(const glm::vec3& p) const
+        {
+            uint32_t bits[3];
+            memcpy(bits, &p, sizeof(bits));
+            return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+        }
+    };
+    struct PositionEqual {
+        bool operator()(const glm::vec3& a, const glm::vec3& b) const { return a.x == b.x && a.y == b.y && a.z == b.z; }
+    };
+    unordered_map<glm::vec3, unsigned int, PositionHash, PositionEqual> positionIds;
+    vector<unsigned int> positionOf(vertexCount);
+    vector<unsigned int> wedges;
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        auto found = positionIds.emplace(vertices[v].Position, static_cast<unsigned int>(wedges.size()));
+        if (found.second)
+            wedges.push_back(0);
+        positionOf[v] = found.first->second;
+        wedges[positionOf[v]]++;
+    }
+
+    // lock seams, and borders: edges that don't have exactly two triangles on them once positions are merged
+    vector<bool> locked(vertexCount, false);
+    unordered_map<uint64_t, unsigned int> edgeUses;
+    auto edgeKey = [&](unsigned int a, unsigned int b)
+    {
+        uint64_t pa = positionOf[a], pb = positionOf[b];
+        return pa < pb ? (pa << 32) | pb : (pb << 32) | pa;
+    };
+    for (size_t i = 0; i < indices.size(); i += 3)
+        for (int k = 0; k < 3; k++)
+            edgeUses[edgeKey(indices[i + k], indices[i + (k + 1) % 3])]++;
+    for (size_t i = 0; i < indices.size(); i += 3)
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int a = indices[i + k], b = indices[i + (k + 1) % 3];
+            if (edgeUses[edgeKey(a, b)] != 2)
+                locked[a] = locked[b] = true;
+        }
+    for (size_t v = 0; v < vertexCount; v++)
+        if (wedges[positionOf[v]] > 1)
+            locked[v] = true;
+
+    // each vertex starts with the planes of the triangles around it
+    vector<Quadric> quadrics(vertexCount);
+    for (size_t i = 0; i < indices.size(); i += 3)
+    {
+        const glm::vec3& p0 = vertices[indices[i]].Position;
+        glm::vec3 normal = glm::cross(vertices[indices[i + 1]].Position - p0, vertices[indices[i + 2]].Position - p0);
+        float length = glm::length(normal);
+        if (length == 0.0f)
+            continue;
+        normal /= length;
+        for (int k = 0; k < 3; k++)
+            quadrics[indices[i + k]].addPlane(normal.x, normal.y, normal.z, -glm::dot(normal, p0));
+    }
+
+    struct Collapse {
+        unsigned int from, to;
+        double cost;
+    };
+    vector<unsigned int> firstTriangle(vertexCount + 1), adjacency, remap(vertexCount);
+    vector<bool> touched(vertexCount);
+    double maxCost = double(maxError) * maxError;
+    double acceptedCost = 0.0;
+    while (indices.size() > targetIndexCount)
+    {
+        // vertex -> triangle adjacency of the current index list
+        size_t triangleCount = indices.size() / 3;
+        std::fill(firstTriangle.begin(), firstTriangle.end(), 0);
+        for (unsigned int index : indices)
+            firstTriangle[index + 1]++;
+        for (size_t v = 0; v < vertexCount; v++)
+            firstTriangle[v + 1] += firstTriangle[v];
+        adjacency.resize(indices.size());
+        vector<unsigned int> filled(firstTriangle.begin(), firstTriangle.end() - 1);
+        for (size_t t = 0; t < triangleCount; t++)
+            for (int k = 0; k < 3; k++)
+                adjacency[filled[indices[t * 3 + k]]++] = static_cast<unsigned int>(t);
+
+        // the cheapest collapse of every movable vertex along one of its edges
+        vector<Collapse> collapses;
+        for (size_t t = 0; t < triangleCount; t++)
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int from = indices[t * 3 + k];
+                if (locked[from])
+                    continue;
+                for (int j = 1; j < 3; j++)
+                {
+                    unsigned int to = indices[t * 3 + (k + j) % 3];
+                    double cost = quadrics[from].error(vertices[to].Position);
+                    if (cost <= maxCost)
+                        collapses.push_back({ from, to, cost });
+                }
+            }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+        // apply them cheapest first; a vertex whose neighbourhood changed waits for the next pass
+        for (size_t v = 0; v < vertexCount; v++)
+            remap[v] = static_cast<unsigned int>(v);
+        std::fill(touched.begin(), touched.end(), false);
+        size_t removable = (indices.size() - targetIndexCount) / 3;
+        size_t removed = 0;
+        for (const Collapse& collapse : collapses)
+        {
+            if (removed >= removable)
+                break;
+            if (touched[collapse.from] || touched[collapse.to])
+                continue;
+
+            // reject collapses that would fold a triangle over (turn it by more than ~75 degrees), and count the ones that disappear
+            bool flips = false;
+            size_t degenerate = 0;
+            for (unsigned int j = firstTriangle[collapse.from]; j < firstTriangle[collapse.from + 1] && !flips; j++)
+            {
+                const unsigned int* triangle = &indices[adjacency[j] * 3];
+                if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+                {
+                    degenerate++;
+                    continue;
+                }
+                glm::vec3 before[3], after[3];
+                for (int k = 0; k < 3; k++)
+                {
+                    before[k] = vertices[triangle[k]].Position;
+                    after[k] = triangle[k] == collapse.from ? vertices[collapse.to].Position : before[k];
+                }
+                glm::vec3 n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+                glm::vec3 n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+                flips = glm::dot(n0, n1) <= 0.25f * glm::length(n0) * glm::length(n1);
+            }
+            if (flips || degenerate == 0)
+                continue;
+
+            remap[collapse.from] = collapse.to;
+            quadrics[collapse.to].add(quadrics[collapse.from]);
+            acceptedCost = std::max(acceptedCost, collapse.cost);
+            removed += degenerate;
+            for (unsigned int j = firstTriangle[collapse.from]; j < firstTriangle[collapse.from + 1]; j++)
+                for (int k = 0; k < 3; k++)
+                    touched[indices[adjacency[j] * 3 + k]] = true;
+        }
+        if (removed == 0)
+            break;
+
+        // rewrite the index list without the triangles that collapsed
+        size_t write = 0;
+        for (size_t i = 0; i < indices.size(); i += 3)
+        {
+            unsigned int a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+            if (a == b || b == c || a == c)
+                continue;
+            indices[write++] = a;
+            indices[write++] = b;
+            indices[write++] = c;
+        }
+        indices.resize(write);
+    }
+
+    error = static_cast<float>(std::sqrt(acceptedCost));
+    return indices;
+}
+
+// appends up to MAX_MESH_LODS - 1 simplified index lists to indices, each with about half the triangles of the
+// one before, and describes all levels (level 0 being the original list) in lods. Stops early once a mesh
+// won't simplify any further, so small or heavily seamed meshes may get fewer levels.
+inline void BuildLods(const vector<Vertex>& vertices, vector<unsigned int>& indices, vector<MeshLod>& lods)
+{
+    lods.clear();
+    lods.push_back({ 0, static_cast<uint32_t>(indices.size()), 0.0f });
+
+    glm::vec3 low = vertices.empty() ? glm::vec3(0.0f) : vertices[0].Position, high = low;
+    for (const Vertex& vertex : vertices)
+    {
+        low = glm::min(low, vertex.Position);
+        high = glm::max(high, vertex.Position);
+    }
+    // nothing coarser may stray further than a quarter of the mesh's size from the original surface
+    float maxError = 0.25f * 0.5f * glm::length(high - low);
+
+    while (lods.size() < MAX_MESH_LODS)
+    {
+        const MeshLod& previous = lods.back();
+        if (previous.indexCount < 3 * 64)
+            break; // not worth another level
+        float error;
+        vector<unsigned int> simplified = SimplifyIndices(vertices.data(), vertices.size(), indices.data() + previous.firstIndex,
+                                                          previous.indexCount, previous.indexCount / 2, maxError, error);
+        if (simplified.size() > previous.indexCount * 3 / 4)
+            break;
+        OptimizeVertexCache(simplified.data(), simplified.size(), vertices.size());
+
+        MeshLod lod;
+        lod.firstIndex = static_cast<uint32_t>(indices.size());
+        lod.indexCount = static_cast<uint32_t>(simplified.size());
+        lod.error = std::max(error, previous.error);
+        indices.insert(indices.end(), simplified.begin(), simplified.end());
+        lods.push_back(lod);
+    }
+}
+
+// renumbers the vertices in the order the index list first uses them, so vertex fetch walks the buffer
+// forwards; vertices no triangle uses are dropped. Returns the new vertex count.
+inline size_t OptimizeVertexFetch(vector<Vertex>& vertices, vector<unsigned int>& indices)
+{
+    const unsigned int unused = ~0u;
+    vector<unsigned int> remap(vertices.size(), unused);
+    vector<Vertex> ordered;
+    ordered.reserve(vertices.size());
+    for (unsigned int& index : indices)
+    {
+        if (remap[index] == unused)
+        {
+            remap[index] = static_cast<unsigned int>(ordered.size());
+            ordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(ordered);
+    return vertices.size();
+}
+#endif
@@ -10,63 +10,611 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include <bvh.h>
 #include <mesh.h>
+#include <mesh_cache.h>
+#include <mesh_optimizer.h>
+#include <obj_reader.h>
+#include <ktx.h>
+#include <load_profiler.h>
+#include <render_queue.h>
 #include <shader_s.h>
+#include <texture_registry.h>
+#include <texture_uploader.h>
 
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <iomanip>
 #include <iostream>
+#include <limits>
 #include <map>
+#include <unordered_map>
 #include <vector>
 using namespace std;
 
+// largest simplification error, as a fraction of the model's bounding radius, allowed in the low-poly copy kept
+// for occlusion culling (see Model::keepOccluder)
+#define OCCLUDER_MAX_ERROR 0.02f
+
+// everything a Model needs that can be produced without a GL context: mesh data and decoded textures.
+// built on any thread by Model::ReadModelData, consumed on the GL thread by Model::Upload.
+struct ModelData {
+    string path;
+    string directory;
+    vector<MeshData> meshes;
+    vector<ImageData> images;       // one entry per distinct texture path referenced by the meshes; only claimed ones get decoded
+    MappedFile cache;               // backs the mesh views when they came from the mesh cache
+    glm::vec3 boundsMin = glm::vec3(0.0f);          // the model's box and sphere, from those of its meshes
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+    glm::vec3 boundsCenter = glm::vec3(0.0f);
+    float boundsRadius = 0.0f;
+    vector<float> lodErrors;                        // see Model::lodErrors
+    vector<glm::vec3> occluderVertices;             // see Model::keepOccluder; only built when asked for
+    vector<unsigned int> occluderIndices;
+    bool valid = false;
+};
+
 unsigned int TextureFromFile(const char* path, const string& directory, bool gamma = false);
+void DecodeImage(ImageData& image, const string& directory);
+size_t UploadCompressedImage(GLenum target, const ImageData& image);
+void FillTexture(unsigned int textureID, ImageData& image);
+void FreeImage(ImageData& image);
+
+// what level of detail selection needs to know about the camera, set up once per frame
+struct LodContext {
+    glm::vec3 cameraPosition;
+    float pixelsPerUnit = 1.0f;     // projected size in pixels of one unit at distance one: viewportHeight / (2 tan(fovy / 2))
+    float pixelError = 1.0f;        // largest acceptable on-screen deviation from the full-detail mesh
+    float hysteresis = 0.25f;       // a coarser level must come in this fraction under pixelError before it is switched to
+
+    LodContext(const glm::vec3& cameraPosition, float fovy, float viewportHeight)
+        : cameraPosition(cameraPosition), pixelsPerUnit(viewportHeight / (2.0f * std::tan(fovy * 0.5f)))
+    {
+    }
+};
 
 class Model
 {
 public:
     // model data 
-    vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
+    vector<Texture> textures_loaded;	// textures this model holds a TextureRegistry reference on, one per distinct file
     vector<Mesh>    meshes;
     string directory;
     bool gammaCorrection;
+    VertexLayout vertexLayout = VertexLayout::Packed;  // layout the meshes are uploaded with; set before loading
+    glm::vec3 boundsMin = glm::vec3(0.0f);              // bounding box of all meshes, in model space
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+    glm::vec3 boundsCenter = glm::vec3(0.0f);           // bounding sphere of all meshes, in model space
+    float boundsRadius = 0.0f;
+    vector<float> lodErrors;                            // per level: the largest error of any mesh at that level
+    bool keepOccluder = false;                          // set before loading to keep a low-poly copy for occlusion culling
+    vector<glm::vec3> occluderVertices;                 // that copy in model space, built while reading; kept by Unload
+    vector<unsigned int> occluderIndices;
+    unsigned int lodLevel = 0;                          // level chosen for the last Draw without a state of its own
 
     // constructor, expects a filepath to a 3D model.
-    Model(string const& path, bool gamma = false) : gammaCorrection(gamma)
+    Model(string const& path, bool gamma = false, VertexLayout layout = VertexLayout::Packed) : gammaCorrection(gamma), vertexLayout(layout)
     {
         loadModel(path);
     }
 
+    // constructs an empty model that is filled in later by Upload (see AssetLoader)
+    Model() : gammaCorrection(false)
+    {
+    }
+
+    // reads the meshes of a model file and lists the textures they reference, touching no GL state so it can run
+    // on a worker thread. A valid mesh cache next to the file is mapped instead of running Assimp; otherwise the
+    // import is optimised, converted to the requested vertex layout (see MeshData::pack) and cached that way for
+    // next time. The images are listed but not decoded (see DecodeImage); each file is claimed in the
+    // TextureRegistry so that only the first model referencing it decodes it. The model's bounds, and its
+    // occluder if keepOccluder is set, are derived here too so that Upload only has GL work left. Parsing and
+    // optimisation are spread over pool when one is given (it may be the pool this runs on), else done in order.
+    static bool ReadModelData(string const& path, ModelData& data, VertexLayout layout = VertexLayout::Packed, bool keepOccluder = false, ThreadPool* pool = nullptr)
+    {
+        // retrieve the directory path of the filepath
+        data.path = path;
+        data.directory = path.substr(0, path.find_last_of('/'));
+
+        LoadScope hashScope(path, "hash");
+        uint64_t sourceHash = MeshCache::HashSource(path, importFlags, layout);
+        hashScope.end();
+        LoadScope cacheScope(path, "cache");
+        bool cached = MeshCache::Load(path, sourceHash, layout, data.meshes, data.cache);
+        cacheScope.end();
+        if (!cached)
+        {
+            // OBJ files go through the dedicated reader; Assimp handles everything else, and OBJs it rejects
+            LoadScope importScope(path, "import");
+            if (!IsObjFile(path) || !ObjReader::Read(path, data.meshes, pool))
+            {
+                // read file via ASSIMP
+                Assimp::Importer importer;
+                std::error_code error;
+                CountBytesRead(static_cast<size_t>(std::filesystem::file_size(path, error)));
+                const aiScene* scene = importer.ReadFile(path, importFlags);
+                // check for errors
+                if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+                {
+                    cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+                    return false;
+                }
+
+                // process ASSIMP's root node recursively
+                processNode(scene->mRootNode, scene, data.meshes);
+            }
+            importScope.end();
+            LoadScope optimizeScope(path, "optimize");
+            ParallelFor(pool, data.meshes.size(), [&](size_t i) { optimizeMesh(data.meshes[i]); });
+            optimizeScope.end();
+            // the indices of a model share one buffer, so they are narrowed only if every mesh's fit 16 bits
+            LoadScope packScope(path, "pack");
+            bool narrow = std::all_of(data.meshes.begin(), data.meshes.end(), [](const MeshData& mesh) { return mesh.vertexCount <= 65536; });
+            for (MeshData& mesh : data.meshes)
+            {
+                // Assimp imports have theirs from processMesh; OBJ meshes get them here
+                if (mesh.boundsRadius < 0.0f)
+                    mesh.computeBounds();
+                mesh.pack(layout);
+                if (narrow)
+                    mesh.narrowIndices();
+            }
+            packScope.end();
+            LoadScope storeScope(path, "store");
+            MeshCache::Store(path, sourceHash, data.meshes);
+        }
+        size_t sourceVertices = 0, vertices = 0, sourceBytes = 0, bytes = 0;
+        for (const MeshData& mesh : data.meshes)
+        {
+            sourceVertices += mesh.sourceVertexCount;
+            vertices += mesh.vertexCount;
+            sourceBytes += mesh.sourceVertexCount * sizeof(Vertex) + mesh.indexCount * sizeof(unsigned int);
+            bytes += mesh.gpuBytes();
+        }
+        // built up front so that lines from concurrent loads don't interleave
+        ostringstream report;
+        report << "MESH:: " << path << "  vertices " << sourceVertices << " -> " << vertices << "  buffers "
+               << std::fixed << std::setprecision(1) << sourceBytes / 1024.0 << " KiB -> " << bytes / 1024.0 << " KiB" << endl;
+        for (size_t i = 0; i < data.meshes.size(); i++)
+        {
+            const MeshData& mesh = data.meshes[i];
+            size_t triangles = mesh.lods.empty() ? mesh.indexCount / 3 : mesh.lods[0].indexCount / 3;
+            report << "  mesh " << i << ": " << triangles << " triangles";
+            for (size_t lod = 1; lod < mesh.lods.size(); lod++)
+                report << (lod == 1 ? " (LODs " : ", ") << mesh.lods[lod].indexCount / 3 << (lod + 1 == mesh.lods.size() ? ")" : "");
+            report << "  ACMR " << std::setprecision(2) << mesh.cacheBefore.acmr << " -> "
+                   << mesh.cacheAfter.acmr << "  ATVR " << mesh.cacheBefore.atvr << " -> " << mesh.cacheAfter.atvr << endl;
+        }
+        cout << report.str();
+
+        computeBounds(data);
+        if (keepOccluder)
+            buildOccluder(data);
+
+        // list every distinct texture path once
+        unordered_map<string, size_t> listed;
+        for (const MeshData& mesh : data.meshes)
+            for (const Texture& texture : mesh.textures)
+                if (listed.emplace(texture.path, data.images.size()).second)
+                {
+                    ImageData image;
+                    image.path = texture.path;
+                    image.key = TextureRegistry::CanonicalPath(data.directory + '/' + texture.path);
+                    image.claimed = TextureRegistry::Instance().claim(image.key);
+                    data.images.push_back(image);
+                }
+
+        data.valid = true;
+        return true;
+    }
+
+    // creates the GL textures and buffers for data read by ReadModelData. Must run on the GL thread;
+    // the decoded pixels are released once uploaded. An image this model didn't claim whose texture has been
+    // released by everyone since (see TextureRegistry::acquire) is decoded here, as nobody else will.
+    void Upload(ModelData& data)
+    {
+        if (!data.valid)
+            return;
+        directory = data.directory;
+        boundsMin = data.boundsMin;
+        boundsMax = data.boundsMax;
+        boundsCenter = data.boundsCenter;
+        boundsRadius = data.boundsRadius;
+        lodErrors = data.lodErrors;
+        if (keepOccluder)
+        {
+            occluderVertices = std::move(data.occluderVertices);
+            occluderIndices = std::move(data.occluderIndices);
+        }
+
+        // take a registry reference on every texture and fill in the ones this model decoded
+        unordered_map<string, unsigned int> ids;
+        for (ImageData& image : data.images)
+        {
+            Texture texture;
+            bool unclaimed;
+            texture.id = TextureRegistry::Instance().acquire(image.key, unclaimed);
+            texture.path = image.path;
+            if (unclaimed && !image.claimed)
+                DecodeImage(image, data.directory);
+            if (image.claimed || unclaimed)
+                FillTexture(texture.id, image);
+            FreeImage(image);
+            textures_loaded.push_back(texture);
+            ids[image.path] = texture.id;
+        }
+
+        LoadScope scope(data.path, "buffers");
+        uploadGeometry(data, ids);
+        buildBatches();
+        for (const MeshData& mesh : data.meshes)
+        {
+            scope.vertices += mesh.vertexCount;
+            scope.triangles += (mesh.lods.empty() ? mesh.indexCount : mesh.lods[0].indexCount) / 3;
+        }
+    }
+
+    // drops this model's texture references; textures no other user holds are deleted
+    void Release()
+    {
+        for (const Texture& texture : textures_loaded)
+            TextureRegistry::Instance().release(texture.id);
+        textures_loaded.clear();
+    }
+
+    // returns the model to its empty state, freeing its buffers and texture references, so it can be loaded
+    // again later. The bounds are kept.
+    void Unload()
+    {
+        Release();
+        for (Mesh& mesh : meshes)
+            mesh.Release();
+        meshes.clear();
+        batches.clear();
+        if (VAO)
+        {
+            glDeleteVertexArrays(1, &VAO);
+            glDeleteBuffers(1, &VBO);
+            glDeleteBuffers(1, &EBO);
+            if (boneVBO)
+                glDeleteBuffers(1, &boneVBO);
+        }
+        VAO = VBO = EBO = boneVBO = 0;
+        bufferBytes = 0;
+        lodErrors.clear();
+        lodLevel = 0;
+    }
+
+    // video memory held by the meshes and the model's textures, shared ones included
+    size_t gpuBytes() const
+    {
+        size_t bytes = bufferBytes;
+        for (const Mesh& mesh : meshes)
+            bytes += mesh.bufferBytes;
+        for (const Texture& texture : textures_loaded)
+            bytes += TextureRegistry::Instance().bytes(texture.id);
+        return bytes;
+    }
+
     // draws the model, and thus all its meshes
     void Draw(Shader& shader)
     {
-        for (unsigned int i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader);
+        drawBatches(shader, 0);
+    }
+
+    // draws the model at the level of detail its projected size calls for. level carries the choice from one frame
+    // to the next for hysteresis, so a model placed several times needs one per placement.
+    void Draw(Shader& shader, const glm::mat4& model, const LodContext& context, unsigned int& level)
+    {
+        level = SelectLod(model, context, level);
+        drawBatches(shader, level);
+    }
+
+    void Draw(Shader& shader, const glm::mat4& model, const LodContext& context)
+    {
+        Draw(shader, model, context, lodLevel);
+    }
+
+    // like Draw, but records one command per batch for RenderQueue::execute() to issue later in the frame. Makes no
+    // GL calls, so any thread may record placements into its own list, as long as each has a level of its own.
+    void Submit(CommandList& list, Shader& shader, const glm::mat4& model, const LodContext& context, unsigned int& level)
+    {
+        level = SelectLod(model, context, level);
+        if (batches.empty())
+            return;
+        unsigned int lod = std::min(level, MAX_MESH_LODS - 1u);
+        unsigned int transform = list.transform(model);
+        for (const DrawBatch& batch : batches)
+        {
+            DrawCommand command;
+            command.shader = &shader;
+            command.material = &meshes[batch.mesh].material;
+            command.vao = VAO;
+            command.indexType = indexType;
+            command.drawCount = static_cast<GLsizei>(batch.baseVertices.size());
+            command.counts = batch.counts[lod].data();
+            command.offsets = batch.offsets[lod].data();
+            command.baseVertices = batch.baseVertices.data();
+            command.boundsCenter = batch.boundsCenter;
+            command.boundsRadius = batch.boundsRadius;
+            list.submit(command, transform);
+        }
+    }
+
+    void Submit(CommandList& list, Shader& shader, const glm::mat4& model, const LodContext& context)
+    {
+        Submit(list, shader, model, context, lodLevel);
+    }
+
+    // coarsest level whose error, scaled by the projected bounding sphere, stays within context.pixelError.
+    // Switching to a coarser level than current needs a margin of context.hysteresis; finer levels are taken at once.
+    unsigned int SelectLod(const glm::mat4& model, const LodContext& context, unsigned int current) const
+    {
+        if (lodErrors.size() < 2 || boundsRadius <= 0.0f)
+            return 0;
+        glm::vec3 center = glm::vec3(model * glm::vec4(boundsCenter, 1.0f));
+        float scale = MaxAxisScale(model);
+        float radius = boundsRadius * scale;
+        float distance = glm::length(center - context.cameraPosition);
+        if (distance <= radius)
+            return 0;
+        // pixels per model unit at the sphere's distance, i.e. the projected radius over the model-space radius
+        float pixelsPerModelUnit = context.pixelsPerUnit * scale / distance;
+
+        unsigned int level = 0;
+        for (unsigned int i = 1; i < lodErrors.size(); i++)
+        {
+            float limit = i > current ? context.pixelError * (1.0f - context.hysteresis) : context.pixelError;
+            if (lodErrors[i] * pixelsPerModelUnit > limit)
+                break;
+            level = i;
+        }
+        return level;
     }
 
 private:
-    // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-    void loadModel(string const& path)
+    // meshes with the same textures, drawn together by one multi-draw per level of detail
+    struct DrawBatch {
+        unsigned int mesh = 0;                          // first mesh of the batch; its textures are bound for all
+        vector<GLint> baseVertices;
+        vector<GLsizei> counts[MAX_MESH_LODS];          // per level: index count and buffer offset of every mesh
+        vector<const void*> offsets[MAX_MESH_LODS];
+        glm::vec3 boundsCenter = glm::vec3(0.0f);      // sphere around the spheres of the batch's meshes
+        float boundsRadius = -1.0f;
+    };
+
+    // one vertex buffer, one index buffer and one vertex array for all meshes, which are views into them
+    unsigned int VAO = 0, VBO = 0, EBO = 0, boneVBO = 0;
+    GLenum indexType = GL_UNSIGNED_INT;
+    size_t bufferBytes = 0;
+    vector<DrawBatch> batches;
+
+    // post-processing applied to every import; part of the mesh cache key
+    static const unsigned int importFlags = aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace;
+
+    // concatenates the meshes into the model's buffers and creates the Mesh views. Indices stay local to their mesh
+    // and are offset by its base vertex at draw time, so they are 16-bit as long as every mesh was narrowed.
+    // The source arrays (possibly mapped cache pages) are copied straight into the buffers.
+    void uploadGeometry(const ModelData& data, unordered_map<string, unsigned int>& textureIds)
+    {
+        if (data.meshes.empty())
+            return;
+        VertexLayout layout = data.meshes[0].layout;
+        size_t vertexCount = 0, indexCount = 0;
+        bool shortIndices = true, skinned = false;
+        for (const MeshData& mesh : data.meshes)
+        {
+            vertexCount += mesh.vertexCount;
+            indexCount += mesh.indexCount;
+            shortIndices = shortIndices && (mesh.indexCount == 0 || mesh.shortIndexData);
+            skinned = skinned || mesh.boneData;
+        }
+        indexType = shortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        size_t indexSize = shortIndices ? sizeof(uint16_t) : sizeof(unsigned int);
+        size_t vertexSize = layout == VertexLayout::Packed ? sizeof(PackedVertex) : sizeof(Vertex);
+
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * vertexSize, nullptr, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * indexSize, nullptr, GL_STATIC_DRAW);
+        bufferBytes = vertexCount * vertexSize + indexCount * indexSize;
+
+        size_t vertexStart = 0, indexStart = 0;
+        for (const MeshData& mesh : data.meshes)
+        {
+            const void* vertices = layout == VertexLayout::Packed ? static_cast<const void*>(mesh.packedData) : mesh.vertexData;
+            const void* indices = shortIndices ? static_cast<const void*>(mesh.shortIndexData) : mesh.indexData;
+            glBufferSubData(GL_ARRAY_BUFFER, vertexStart * vertexSize, mesh.vertexCount * vertexSize, vertices);
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indexStart * indexSize, mesh.indexCount * indexSize, indices);
+
+            vector<Texture> textures = mesh.textures;
+            for (Texture& texture : textures)
+                texture.id = textureIds[texture.path];
+            meshes.push_back(Mesh(mesh, textures, VAO, indexType, static_cast<GLint>(vertexStart), static_cast<unsigned int>(indexStart)));
+            vertexStart += mesh.vertexCount;
+            indexStart += mesh.indexCount;
+        }
+        SetVertexAttributes(layout);
+
+        // if any mesh is skinned they all get a bone stream; the others with no influences
+        if (skinned)
+        {
+            glGenBuffers(1, &boneVBO);
+            glBindBuffer(GL_ARRAY_BUFFER, boneVBO);
+            glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(VertexBones), nullptr, GL_STATIC_DRAW);
+            bufferBytes += vertexCount * sizeof(VertexBones);
+            VertexBones none = { { -1, -1, -1, -1 }, { 0, 0, 0, 0 } };
+            vertexStart = 0;
+            for (const MeshData& mesh : data.meshes)
+            {
+                if (!mesh.boneData)
+                {
+                    vector<VertexBones> fill(mesh.vertexCount, none);
+                    glBufferSubData(GL_ARRAY_BUFFER, vertexStart * sizeof(VertexBones), fill.size() * sizeof(VertexBones), fill.data());
+                }
+                else
+                    glBufferSubData(GL_ARRAY_BUFFER, vertexStart * sizeof(VertexBones), mesh.vertexCount * sizeof(VertexBones), mesh.boneData);
+                vertexStart += mesh.vertexCount;
+            }
+            SetBoneAttributes();
+        }
+        glBindVertexArray(0);
+    }
+
+    // groups the meshes by their texture set and precomputes the multi-draw arrays of every level of detail
+    void buildBatches()
     {
-        // read file via ASSIMP
-        Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
-        // check for errors
-        if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+        batches.clear();
+        unordered_map<string, size_t> batchByMaterial;
+        vector<size_t> batchOf(meshes.size());
+        for (unsigned int i = 0; i < meshes.size(); i++)
         {
-            cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+            string material;
+            for (const Texture& texture : meshes[i].textures)
+                material += texture.type + '\n' + std::to_string(texture.id) + '\n';
+            auto found = batchByMaterial.emplace(material, batches.size());
+            if (found.second)
+            {
+                batches.emplace_back();
+                batches.back().mesh = i;
+            }
+            DrawBatch& batch = batches[found.first->second];
+            batch.baseVertices.push_back(meshes[i].baseVertex);
+            for (unsigned int lod = 0; lod < MAX_MESH_LODS; lod++)
+            {
+                batch.counts[lod].push_back(static_cast<GLsizei>(meshes[i].Level(lod).indexCount));
+                batch.offsets[lod].push_back(meshes[i].IndexOffset(lod));
+            }
+            batchOf[i] = found.first->second;
+        }
+
+        // each batch's sphere is centred on the box around its meshes' boxes and encloses their spheres
+        vector<glm::vec3> low(batches.size()), high(batches.size());
+        vector<bool> bounded(batches.size(), false);
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            size_t b = batchOf[i];
+            low[b] = bounded[b] ? glm::min(low[b], meshes[i].boundsMin) : meshes[i].boundsMin;
+            high[b] = bounded[b] ? glm::max(high[b], meshes[i].boundsMax) : meshes[i].boundsMax;
+            bounded[b] = true;
+        }
+        for (size_t b = 0; b < batches.size(); b++)
+            batches[b].boundsCenter = (low[b] + high[b]) * 0.5f;
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            DrawBatch& batch = batches[batchOf[i]];
+            if (meshes[i].boundsRadius < 0.0f)
+                batch.boundsRadius = std::numeric_limits<float>::infinity(); // unknown: never culled
+            else
+                batch.boundsRadius = std::max(batch.boundsRadius, glm::length(meshes[i].boundsCenter - batch.boundsCenter) + meshes[i].boundsRadius);
+        }
+    }
+
+    // binds the shared vertex array once; every batch then costs its texture binds and a single draw call
+    void drawBatches(Shader& shader, unsigned int lod)
+    {
+        if (batches.empty())
             return;
+        lod = std::min(lod, MAX_MESH_LODS - 1u);
+        GLState::Instance().bindVertexArray(VAO);
+        for (const DrawBatch& batch : batches)
+        {
+            meshes[batch.mesh].BindTextures(shader);
+            GLsizei drawCount = static_cast<GLsizei>(batch.baseVertices.size());
+            if (drawCount == 1)
+                glDrawElementsBaseVertex(GL_TRIANGLES, batch.counts[lod][0], indexType, batch.offsets[lod][0], batch.baseVertices[0]);
+            else
+                glMultiDrawElementsBaseVertex(GL_TRIANGLES, batch.counts[lod].data(), indexType, batch.offsets[lod].data(), drawCount, batch.baseVertices.data());
         }
-        // retrieve the directory path of the filepath
-        directory = path.substr(0, path.find_last_of('/'));
+    }
+
+    // the positions of each mesh at its coarsest level of detail that stays within OCCLUDER_MAX_ERROR of the model's
+    // radius from the full surface, so the copy hides little that the model itself doesn't
+    static void buildOccluder(ModelData& data)
+    {
+        vector<glm::vec3>& occluderVertices = data.occluderVertices;
+        vector<unsigned int>& occluderIndices = data.occluderIndices;
+        occluderVertices.clear();
+        occluderIndices.clear();
+        for (const MeshData& mesh : data.meshes)
+        {
+            MeshLod level{ 0, static_cast<uint32_t>(mesh.indexCount), 0.0f };
+            for (const MeshLod& lod : mesh.lods)
+                if (lod.error <= OCCLUDER_MAX_ERROR * data.boundsRadius)
+                    level = lod;
+            vector<unsigned int> remap(mesh.vertexCount, ~0u);
+            for (uint32_t i = level.firstIndex; i < level.firstIndex + level.indexCount; i++)
+            {
+                unsigned int& index = remap[mesh.index(i)];
+                if (index == ~0u)
+                {
+                    index = static_cast<unsigned int>(occluderVertices.size());
+                    occluderVertices.push_back(mesh.position(mesh.index(i)));
+                }
+                occluderIndices.push_back(index);
+            }
+        }
+    }
+
+    // box around the meshes' boxes, the sphere centred on it that encloses each mesh's sphere or box (whichever
+    // reaches less far), and the error of each level of detail across meshes
+    static void computeBounds(ModelData& data)
+    {
+        glm::vec3 low(0.0f), high(0.0f);
+        bool first = true;
+        for (const MeshData& mesh : data.meshes)
+            if (mesh.vertexCount)
+            {
+                low = first ? mesh.boundsMin : glm::min(low, mesh.boundsMin);
+                high = first ? mesh.boundsMax : glm::max(high, mesh.boundsMax);
+                first = false;
+            }
+        data.boundsMin = low;
+        data.boundsMax = high;
+        data.boundsCenter = (low + high) * 0.5f;
+        data.boundsRadius = 0.0f;
+        for (const MeshData& mesh : data.meshes)
+            if (mesh.vertexCount)
+            {
+                float sphere = glm::length(mesh.boundsCenter - data.boundsCenter) + mesh.boundsRadius;
+                float corner = glm::length(glm::max(glm::abs(mesh.boundsMin - data.boundsCenter), glm::abs(mesh.boundsMax - data.boundsCenter)));
+                data.boundsRadius = std::max(data.boundsRadius, std::min(sphere, corner));
+            }
+
+        // a mesh with fewer levels stays at its coarsest one, so its error carries over to the levels above
+        vector<float>& lodErrors = data.lodErrors;
+        lodErrors.assign(1, 0.0f);
+        for (const MeshData& mesh : data.meshes)
+            for (size_t i = 1; i < mesh.lods.size(); i++)
+            {
+                if (lodErrors.size() <= i)
+                    lodErrors.resize(i + 1, 0.0f);
+                lodErrors[i] = std::max(lodErrors[i], mesh.lods[i].error);
+            }
+        for (const MeshData& mesh : data.meshes)
+            for (size_t i = std::max<size_t>(mesh.lods.size(), 1); i < lodErrors.size(); i++)
+                lodErrors[i] = std::max(lodErrors[i], mesh.lods.empty() ? 0.0f : mesh.lods.back().error);
+    }
 
-        // process ASSIMP's root node recursively
-        processNode(scene->mRootNode, scene);
+    // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
+    void loadModel(string const& path)
+    {
+        ModelData data;
+        if (!ReadModelData(path, data, vertexLayout, keepOccluder))
+            return;
+        for (ImageData& image : data.images)
+            if (image.claimed)
+                DecodeImage(image, data.directory);
+        Upload(data);
     }
 
     // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-    void processNode(aiNode* node, const aiScene* scene)
+    static void processNode(aiNode* node, const aiScene* scene, vector<MeshData>& data)
     {
         // process each mesh located at the current node
         for (unsigned int i = 0; i < node->mNumMeshes; i++)
@@ -74,27 +622,33 @@ private:
             // the node object only contains indices to index the actual objects in the scene. 
             // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            data.push_back(processMesh(mesh, scene));
         }
         // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
         for (unsigned int i = 0; i < node->mNumChildren; i++)
         {
-            processNode(node->mChildren[i], scene);
+            processNode(node->mChildren[i], scene, data);
         }
 
     }
 
-    Mesh processMesh(aiMesh* mesh, const aiScene* scene)
+    static MeshData processMesh(aiMesh* mesh, const aiScene* scene)
     {
         // data to fill
-        vector<Vertex> vertices;
-        vector<unsigned int> indices;
-        vector<Texture> textures;
+        MeshData data;
+        vector<Vertex>& vertices = data.vertices;
+        vector<unsigned int>& indices = data.indices;
+        vector<Texture>& textures = data.textures;
 
         // walk through each of the mesh's vertices
         for (unsigned int i = 0; i < mesh->mNumVertices; i++)
         {
             Vertex vertex;
+            for (int j = 0; j < MAX_BONE_INFLUENCE; j++)
+            {
+                vertex.m_BoneIDs[j] = -1;
+                vertex.m_Weights[j] = 0.0f;
+            }
             glm::vec3 vector; // we declare a placeholder vector since assimp uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
             // positions
             vector.x = mesh->mVertices[i].x;
@@ -130,10 +684,30 @@ private:
                 vertex.Bitangent = vector;
             }
             else
+            {
                 vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+                vertex.Tangent = glm::vec3(0.0f);
+                vertex.Bitangent = glm::vec3(0.0f);
+            }
 
             vertices.push_back(vertex);
         }
+        // bone influences, indexed by the mesh's own bone list; each vertex keeps its first MAX_BONE_INFLUENCE weights
+        for (unsigned int b = 0; b < mesh->mNumBones; b++)
+        {
+            const aiBone* bone = mesh->mBones[b];
+            for (unsigned int w = 0; w < bone->mNumWeights; w++)
+            {
+                Vertex& vertex = vertices[bone->mWeights[w].mVertexId];
+                for (int j = 0; j < MAX_BONE_INFLUENCE; j++)
+                    if (vertex.m_BoneIDs[j] < 0)
+                    {
+                        vertex.m_BoneIDs[j] = static_cast<int>(b);
+                        vertex.m_Weights[j] = bone->mWeights[w].mWeight;
+                        break;
+                    }
+            }
+        }
         // now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
         for (unsigned int i = 0; i < mesh->mNumFaces; i++)
         {
@@ -164,82 +738,179 @@ private:
         std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
         textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
 
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        // return the extracted mesh data; the GL objects are created once it has been cached
+        data.useOwnedArrays();
+        data.computeBounds();
+        return data;
+    }
+
+    static bool IsObjFile(const string& path)
+    {
+        size_t dot = path.find_last_of('.');
+        if (dot == string::npos || path.size() - dot != 4)
+            return false;
+        string extension = path.substr(dot + 1);
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return extension == "obj";
     }
 
-    // checks all material textures of a given type and loads the textures if they're not loaded yet.
-    // the required info is returned as a Texture struct.
-    vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName)
+    // load-time passes over a freshly imported mesh, whichever importer produced it; their result is what gets cached
+    static void optimizeMesh(MeshData& data)
+    {
+        vector<Vertex>& vertices = data.vertices;
+        vector<unsigned int>& indices = data.indices;
+
+        // OBJ imports come without shared vertices: weld the identical ones
+        data.sourceVertexCount = vertices.size();
+        WeldVertices(vertices, indices);
+        // then reorder the triangles for the post-transform cache and for overdraw, and the vertices to match
+        data.cacheBefore = AnalyzeVertexCache(indices.data(), indices.size(), vertices.size());
+        OptimizeVertexCache(indices.data(), indices.size(), vertices.size());
+        OptimizeOverdraw(indices.data(), indices.size(), vertices.data(), vertices.size());
+        OptimizeVertexFetch(vertices, indices);
+        data.cacheAfter = AnalyzeVertexCache(indices.data(), indices.size(), vertices.size());
+        // and simplify it into coarser levels of detail, appended to the same index list
+        BuildLods(vertices, indices, data.lods);
+
+        data.useOwnedArrays();
+    }
+
+    // collects the material textures of a given type. Only the type and path are filled in here,
+    // the GL texture is resolved by Upload.
+    static vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName)
     {
         vector<Texture> textures;
         for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for (unsigned int j = 0; j < textures_loaded.size(); j++)
-            {
-                if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if (!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-            }
+            Texture texture;
+            texture.id = 0;
+            texture.type = typeName;
+            texture.path = str.C_Str();
+            textures.push_back(texture);
         }
         return textures;
     }
 };
 
 
+// loads (or shares) the texture at path, relative to directory if one is given. The caller holds a
+// TextureRegistry reference on the returned texture.
 unsigned int TextureFromFile(const char* path, const string& directory, bool gamma)
 {
-    string filename = string(path);
-    filename = directory + '/' + filename;
+    ImageData image;
+    image.path = path;
+    image.key = TextureRegistry::CanonicalPath(directory.empty() ? image.path : directory + '/' + image.path);
 
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+    TextureRegistry& registry = TextureRegistry::Instance();
+    bool claimed = registry.claim(image.key);
+    unsigned int textureID = registry.acquire(image.key);
+    if (claimed)
+    {
+        DecodeImage(image, directory);
+        FillTexture(textureID, image);
+        FreeImage(image);
+    }
+    return textureID;
+}
 
-    int width, height, nrComponents;
-    unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
+// decodes image.path (relative to directory, if one is given) into image.pixels; safe to call from worker threads.
+// an up-to-date baked container (see texture_bake.h) in a format the context supports is read instead.
+void DecodeImage(ImageData& image, const string& directory)
+{
+    string filename = directory.empty() ? image.path : directory + '/' + image.path;
+    LoadScope scope(image.key.empty() ? filename : image.key, "decode");
+    std::error_code error;
+    KtxTexture baked;
+    if (KtxIsFresh(filename) && ReadKtx(KtxPath(filename), baked) && KtxFormatSupported(baked.internalFormat))
     {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
+        scope.bytesRead = static_cast<size_t>(std::filesystem::file_size(KtxPath(filename), error));
+        image.compressedFormat = baked.internalFormat;
+        image.width = baked.width;
+        image.height = baked.height;
+        image.levels = std::move(baked.levels);
+        return;
+    }
+    image.pixels = stbi_load(filename.c_str(), &image.width, &image.height, &image.components, 0);
+    if (image.pixels)
+        scope.bytesRead = static_cast<size_t>(std::filesystem::file_size(filename, error));
+}
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+// uploads a baked mip chain to target (a 2D texture or one cube map face); returns the bytes uploaded
+size_t UploadCompressedImage(GLenum target, const ImageData& image)
+{
+    size_t bytes = 0;
+    for (unsigned int level = 0; level < image.levels.size(); level++)
+    {
+        int width = std::max(1, image.width >> level);
+        int height = std::max(1, image.height >> level);
+        glCompressedTexImage2D(target, level, image.compressedFormat, width, height, 0,
+                               static_cast<GLsizei>(image.levels[level].size()), image.levels[level].data());
+        bytes += image.levels[level].size();
+    }
+    return bytes;
+}
 
+// gives textureID its pixels and a mip chain. With a TextureUploader active the pixels are handed over to it
+// and arrive through its PBO ring over the next frames; otherwise they are uploaded right away.
+void FillTexture(unsigned int textureID, ImageData& image)
+{
+    LoadScope scope(image.key.empty() ? image.path : image.key, "upload");
+    if (image.compressedFormat)
+    {
+        // baked containers already hold every mip level, so there is nothing to generate
+        glBindTexture(GL_TEXTURE_2D, textureID);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(image.levels.size()) - 1);
+        if (image.compressedFormat == GL_COMPRESSED_RED_RGTC1)
+        {
+            // single-channel bump maps sample as grey, like the greyscale source they were baked from
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_G, GL_RED);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, GL_RED);
+        }
+        scope.textureBytes = UploadCompressedImage(GL_TEXTURE_2D, image);
+        TextureRegistry::Instance().setBytes(textureID, scope.textureBytes);
+        return;
+    }
+    if (!image.pixels)
+    {
+        std::cout << "Texture failed to load at path: " << image.path << std::endl;
+        return;
+    }
 
-        stbi_image_free(data);
+    GLenum format = ImageFormat(image.components);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // a full mip chain adds a third on top of the base level
+    TextureRegistry::Instance().setBytes(textureID, size_t(image.width) * image.height * image.components * 4 / 3);
+
+    if (TextureUploader* uploader = TextureUploader::Current())
+    {
+        uploader->queue(textureID, GL_TEXTURE_2D, image, true);
     }
     else
     {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.pixels);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        scope.textureBytes = size_t(image.width) * image.height * image.components;
+        scope.end();
+        LoadScope mipmapScope(image.key.empty() ? image.path : image.key, "mipmap");
+        glGenerateMipmap(GL_TEXTURE_2D);
     }
+}
 
-    return textureID;
+void FreeImage(ImageData& image)
+{
+    stbi_image_free(image.pixels);
+    image.pixels = nullptr;
+    image.levels.clear();
 }
 #endif
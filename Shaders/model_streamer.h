@@ -0,0 +1,308 @@
+#ifndef MODEL_STREAMER_H
+#define MODEL_STREAMER_H
+
+#include <glad/glad.h>
+
+#include <glm.hpp>
+#include <gtc/matrix_transform.hpp>
+
+#include <asset_loader.h>
+#include <bvh.h>
+#include <mesh_cache.h>
+#include <model.h>
+#include <render_queue.h>
+
+#include <algorithm>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Loads models on demand as the camera approaches them. A streamed model starts out empty. Each Draw measures
+// the camera's distance to the placement's bounding sphere; once that comes within loadRadius the model is
+// handed to the AssetLoader, and a wireframe box stands in for it until the upload is done. A model whose
+// placements have all been beyond unloadRadius for unloadDelay seconds can be unloaded again. That only happens
+// while the streamed models together hold more than memoryBudget bytes, the longest-forgotten ones first.
+// Placeholder boxes come from the mesh cache header, or from the model itself once it has been loaded.
+class ModelStreamer
+{
+public:
+    // needs a current GL context for the placeholder; unloadRadius should leave a margin over loadRadius
+    ModelStreamer(AssetLoader& loader, float loadRadius, float unloadRadius, double unloadDelay = 10.0, size_t memoryBudget = 64 << 20)
+        : loader(loader), loadRadius(loadRadius), unloadRadius(unloadRadius), unloadDelay(unloadDelay), memoryBudget(memoryBudget)
+    {
+        createPlaceholder();
+    }
+
+    ModelStreamer(const ModelStreamer&) = delete;
+    ModelStreamer& operator=(const ModelStreamer&) = delete;
+
+    // streams path into model, which must outlive the streamer and must not be loaded by anyone else
+    void add(Model& model, const string& path)
+    {
+        Entry entry;
+        entry.model = &model;
+        entry.path = path;
+        if (!MeshCache::ReadBounds(path, entry.boundsMin, entry.boundsMax))
+        {
+            // never imported: a unit box until the first load tells us better
+            entry.boundsMin = glm::vec3(-1.0f);
+            entry.boundsMax = glm::vec3(1.0f);
+        }
+        entries.push_back(entry);
+    }
+
+    // call once per frame on the GL thread, after the frame's draws: starts loads for models drawn close
+    // enough, takes in finished ones and unloads far-away ones while over budget. True if a model came in, as its
+    // bounds (see bounds()) may have changed with it.
+    bool update(double now)
+    {
+        size_t resident = 0;
+        bool loaded = false;
+        for (Entry& entry : entries)
+        {
+            if (entry.state == State::Unloaded && entry.nearest <= loadRadius)
+            {
+                entry.ready = loader.load(*entry.model, entry.path, false);
+                entry.state = State::Loading;
+            }
+            else if (entry.state == State::Loading && entry.ready.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+            {
+                entry.state = State::Resident;
+                entry.boundsMin = entry.model->boundsMin;
+                entry.boundsMax = entry.model->boundsMax;
+                entry.bytes = entry.model->gpuBytes();
+                loaded = true;
+                cout << "STREAM:: loaded " << entry.path << "  " << std::fixed << std::setprecision(1) << entry.bytes / 1024.0 << " KiB" << endl;
+            }
+
+            if (entry.state == State::Resident)
+            {
+                resident += entry.bytes;
+                if (entry.nearest <= unloadRadius)
+                    entry.farSince = -1.0;
+                else if (entry.farSince < 0.0)
+                    entry.farSince = now;
+            }
+            entry.nearest = std::numeric_limits<float>::max();
+        }
+
+        if (resident <= memoryBudget)
+            return loaded;
+        vector<Entry*> candidates;
+        for (Entry& entry : entries)
+            if (entry.state == State::Resident && entry.farSince >= 0.0 && now - entry.farSince >= unloadDelay)
+                candidates.push_back(&entry);
+        std::sort(candidates.begin(), candidates.end(), [](const Entry* a, const Entry* b) { return a->farSince < b->farSince; });
+        for (Entry* entry : candidates)
+        {
+            if (resident <= memoryBudget)
+                break;
+            entry->model->Unload();
+            entry->state = State::Unloaded;
+            entry->farSince = -1.0;
+            resident -= entry->bytes;
+            cout << "STREAM:: unloaded " << entry->path << "  " << std::fixed << std::setprecision(1) << entry->bytes / 1024.0 << " KiB" << endl;
+            entry->bytes = 0;
+        }
+        return loaded;
+    }
+
+    // counts a placement of a streamed model as seen from cameraPosition this frame, as Draw and Submit do, for
+    // placements that are culled before either is called
+    void Track(Model& model, const glm::mat4& placement, const glm::vec3& cameraPosition)
+    {
+        if (Entry* entry = find(model))
+            entry->nearest = std::min(entry->nearest, distance(*entry, placement, cameraPosition));
+    }
+
+    bool streams(const Model& model) const
+    {
+        return find(model) != nullptr;
+    }
+
+    // the model-space bounding box of a model: for a streamed one the box its placeholder is drawn with, which
+    // is known before it is loaded, for any other the model's own
+    void bounds(const Model& model, glm::vec3& low, glm::vec3& high) const
+    {
+        const Entry* entry = find(model);
+        low = entry ? entry->boundsMin : model.boundsMin;
+        high = entry ? entry->boundsMax : model.boundsMax;
+    }
+
+    // draws one placement of a streamed model (with its level of detail, see Model::Draw), or its placeholder box
+    // while it isn't resident. The "model" uniform must already hold the placement's matrix.
+    void Draw(Model& model, Shader& shader, const glm::mat4& placement, const LodContext& context, unsigned int& level)
+    {
+        Entry* entry = find(model);
+        if (!entry)
+        {
+            model.Draw(shader, placement, context, level);
+            return;
+        }
+        entry->nearest = std::min(entry->nearest, distance(*entry, placement, context.cameraPosition));
+        if (entry->state == State::Resident)
+            model.Draw(shader, placement, context, level);
+        else
+            drawPlaceholder(*entry, shader, placement);
+    }
+
+    void Draw(Model& model, Shader& shader, const glm::mat4& placement, const LodContext& context)
+    {
+        Draw(model, shader, placement, context, model.lodLevel);
+    }
+
+    // the RenderQueue counterpart of Draw: records a resident model, or its placeholder box, into list. Unlike
+    // Draw it neither tracks the placement (call Track for that) nor touches GL, so worker threads may call it
+    // while the GL thread doesn't run update().
+    void Submit(CommandList& list, Model& model, Shader& shader, const glm::mat4& placement, const LodContext& context, unsigned int& level)
+    {
+        const Entry* entry = find(model);
+        if (!entry || entry->state == State::Resident)
+            model.Submit(list, shader, placement, context, level);
+        else
+            submitPlaceholder(list, *entry, shader, placement);
+    }
+
+    void Submit(CommandList& list, Model& model, Shader& shader, const glm::mat4& placement, const LodContext& context)
+    {
+        Submit(list, model, shader, placement, context, model.lodLevel);
+    }
+
+    // video memory held by the streamed models that are resident
+    size_t residentBytes() const
+    {
+        size_t bytes = 0;
+        for (const Entry& entry : entries)
+            bytes += entry.bytes;
+        return bytes;
+    }
+
+    // releases the placeholder; call while the context is still current
+    void release()
+    {
+        glDeleteVertexArrays(1, &placeholderVAO);
+        glDeleteBuffers(1, &placeholderVBO);
+        glDeleteBuffers(1, &placeholderEBO);
+        glDeleteTextures(1, &placeholderTexture);
+        placeholderVAO = placeholderVBO = placeholderEBO = placeholderTexture = 0;
+    }
+
+private:
+    enum class State { Unloaded, Loading, Resident };
+
+    struct Entry {
+        Model* model = nullptr;
+        string path;
+        State state = State::Unloaded;
+        shared_future<void> ready;
+        glm::vec3 boundsMin = glm::vec3(0.0f);
+        glm::vec3 boundsMax = glm::vec3(0.0f);
+        float nearest = std::numeric_limits<float>::max();     // closest placement drawn since the last update
+        double farSince = -1.0;                                 // when every placement went beyond unloadRadius, -1 if one is within
+        size_t bytes = 0;
+    };
+
+    AssetLoader& loader;
+    float loadRadius;
+    float unloadRadius;
+    double unloadDelay;
+    size_t memoryBudget;
+    vector<Entry> entries;
+    unsigned int placeholderVAO = 0, placeholderVBO = 0, placeholderEBO = 0, placeholderTexture = 0;
+    Material placeholderMaterial;
+    // the placeholder's one index range, for the DrawCommands that point at it
+    GLsizei placeholderCount = 24;
+    const void* placeholderOffset = nullptr;
+    GLint placeholderBaseVertex = 0;
+
+    // the model's bounding box in place of the model; leaves the "model" uniform at placement
+    void drawPlaceholder(const Entry& entry, Shader& shader, const glm::mat4& placement)
+    {
+        glm::mat4 box = glm::translate(placement, entry.boundsMin);
+        box = glm::scale(box, glm::max(entry.boundsMax - entry.boundsMin, glm::vec3(1e-4f)));
+        shader.modelUniform.set(box);
+        GLState::Instance().bindTexture(0, GL_TEXTURE_2D, placeholderTexture);
+        GLState::Instance().bindVertexArray(placeholderVAO);
+        glDrawElements(GL_LINES, 24, GL_UNSIGNED_BYTE, 0);
+        shader.modelUniform.set(placement);
+    }
+
+    // the queued form of drawPlaceholder: the unit cube's edges, scaled to the box
+    void submitPlaceholder(CommandList& list, const Entry& entry, Shader& shader, const glm::mat4& placement)
+    {
+        glm::mat4 box = glm::translate(placement, entry.boundsMin);
+        box = glm::scale(box, glm::max(entry.boundsMax - entry.boundsMin, glm::vec3(1e-4f)));
+        DrawCommand command;
+        command.mode = GL_LINES;
+        command.shader = &shader;
+        command.material = &placeholderMaterial;
+        command.vao = placeholderVAO;
+        command.indexType = GL_UNSIGNED_BYTE;
+        command.drawCount = 1;
+        command.counts = &placeholderCount;
+        command.offsets = &placeholderOffset;
+        command.baseVertices = &placeholderBaseVertex;
+        command.boundsCenter = glm::vec3(0.5f);
+        command.boundsRadius = 0.8660254f;
+        list.submit(command, list.transform(box));
+    }
+
+    Entry* find(const Model& model)
+    {
+        for (Entry& entry : entries)
+            if (entry.model == &model)
+                return &entry;
+        return nullptr;
+    }
+
+    const Entry* find(const Model& model) const
+    {
+        return const_cast<ModelStreamer*>(this)->find(model);
+    }
+
+    // from the camera to the surface of the placement's bounding sphere, 0 inside it
+    static float distance(const Entry& entry, const glm::mat4& placement, const glm::vec3& camera)
+    {
+        glm::vec3 center = glm::vec3(placement * glm::vec4((entry.boundsMin + entry.boundsMax) * 0.5f, 1.0f));
+        float radius = glm::length(entry.boundsMax - entry.boundsMin) * 0.5f * MaxAxisScale(placement);
+        return std::max(0.0f, glm::length(center - camera) - radius);
+    }
+
+    // the edges of the unit cube, drawn as lines with a flat grey texture so any textured shader can draw them
+    void createPlaceholder()
+    {
+        float corners[] = {
+            0.0f, 0.0f, 0.0f,  1.0f, 0.0f, 0.0f,  1.0f, 1.0f, 0.0f,  0.0f, 1.0f, 0.0f,
+            0.0f, 0.0f, 1.0f,  1.0f, 0.0f, 1.0f,  1.0f, 1.0f, 1.0f,  0.0f, 1.0f, 1.0f
+        };
+        unsigned char edges[] = {
+            0, 1, 1, 2, 2, 3, 3, 0,
+            4, 5, 5, 6, 6, 7, 7, 4,
+            0, 4, 1, 5, 2, 6, 3, 7
+        };
+        glGenVertexArrays(1, &placeholderVAO);
+        glGenBuffers(1, &placeholderVBO);
+        glGenBuffers(1, &placeholderEBO);
+        glBindVertexArray(placeholderVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, placeholderVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, placeholderEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(edges), edges, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glBindVertexArray(0);
+
+        unsigned char grey[4] = { 180, 180, 180, 255 };
+        glGenTextures(1, &placeholderTexture);
+        glBindTexture(GL_TEXTURE_2D, placeholderTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        placeholderMaterial = Material(vector<Texture>{ Texture{ placeholderTexture, "texture_diffuse", "" } });
+    }
+};
+#endif
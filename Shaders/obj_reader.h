@@ -0,0 +1,570 @@
+#ifndef OBJ_READER_H
+#define OBJ_READER_H
+
+#include <glm.hpp>
+
+#include <mesh.h>
+#include <mapped_file.h>
+#include <load_profiler.h>
+#include <thread_pool.h>
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// Wavefront OBJ/MTL reader used by Model::ReadModelData instead of Assimp for .obj files. The file is mapped and
+// cut into line-aligned chunks that are tokenised in parallel with std::from_chars; the chunks are then stitched
+// together into one MeshData per material. The result matches what processMesh makes of an Assimp import with
+// Model::importFlags: polygons fanned into triangles, smooth normals where the file has none, V flipped, and
+// tangents/bitangents derived from the UVs.
+class ObjReader
+{
+public:
+    // fills meshes from the OBJ file at path, in parallel on pool if one is given; false if it can't be mapped, has
+    // no faces or has out-of-range indices, in which case the caller should fall back to Assimp
+    static bool Read(const string& path, vector<MeshData>& meshes, ThreadPool* pool = nullptr)
+    {
+        MappedFile file(path);
+        if (!file.isOpen() || file.size() == 0)
+            return false;
+        const char* text = reinterpret_cast<const char*>(file.data());
+        size_t size = file.size();
+        CountBytesRead(size);
+
+        // line-aligned chunks of at least minChunkSize, at most one per thread that can work on them
+        const size_t minChunkSize = 256 << 10;
+        size_t chunkCount = std::max<size_t>(1, std::min<size_t>(pool ? pool->size() + 1 : 1, size / minChunkSize));
+        vector<size_t> bounds(1, 0);
+        for (size_t c = 1; c < chunkCount; c++)
+        {
+            size_t start = std::max(bounds.back(), size * c / chunkCount);
+            const char* split = static_cast<const char*>(memchr(text + start, '\n', size - start));
+            if (!split)
+                break;
+            bounds.push_back(split + 1 - text);
+        }
+        bounds.push_back(size);
+
+        vector<Chunk> chunks(bounds.size() - 1);
+        ParallelFor(pool, chunks.size(), [&](size_t c) { parseChunk(text + bounds[c], text + bounds[c + 1], chunks[c]); });
+
+        // concatenate the attribute arrays and resolve every index against them
+        vector<glm::vec3> positions, normals;
+        vector<glm::vec2> texcoords;
+        vector<size_t> positionBase, normalBase, texcoordBase;
+        for (const Chunk& chunk : chunks)
+        {
+            positionBase.push_back(positions.size());
+            normalBase.push_back(normals.size());
+            texcoordBase.push_back(texcoords.size());
+            positions.insert(positions.end(), chunk.positions.begin(), chunk.positions.end());
+            normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+            texcoords.insert(texcoords.end(), chunk.texcoords.begin(), chunk.texcoords.end());
+        }
+        vector<char> valid(chunks.size(), 1);
+        ParallelFor(pool, chunks.size(), [&](size_t c)
+        {
+            for (Corner& corner : chunks[c].corners)
+            {
+                valid[c] &= resolve(corner.v, positionBase[c], positions.size(), false);
+                valid[c] &= resolve(corner.vt, texcoordBase[c], texcoords.size(), true);
+                valid[c] &= resolve(corner.vn, normalBase[c], normals.size(), true);
+            }
+        });
+        if (std::find(valid.begin(), valid.end(), 0) != valid.end())
+            return false;
+
+        // group the triangles by material, in order of first use; faces before any usemtl get the default material
+        vector<string> materialNames;
+        vector<vector<Range>> ranges;
+        unordered_map<string, size_t> meshOfMaterial;
+        string material;
+        vector<string> libraries;
+        size_t triangleCount = 0;
+        for (const Chunk& chunk : chunks)
+        {
+            size_t triangles = chunk.corners.size() / 3;
+            triangleCount += triangles;
+            libraries.insert(libraries.end(), chunk.libraries.begin(), chunk.libraries.end());
+            for (size_t r = 0; r <= chunk.runs.size(); r++)
+            {
+                size_t first = r == 0 ? 0 : chunk.runs[r - 1].firstTriangle;
+                size_t end = r == chunk.runs.size() ? triangles : chunk.runs[r].firstTriangle;
+                if (r > 0)
+                    material = chunk.runs[r - 1].name;
+                if (first == end)
+                    continue;
+                auto found = meshOfMaterial.emplace(material, ranges.size());
+                if (found.second)
+                {
+                    materialNames.push_back(material);
+                    ranges.emplace_back();
+                }
+                ranges[found.first->second].push_back({ &chunk, first, end });
+            }
+        }
+        if (triangleCount == 0)
+            return false;
+
+        string directory = path.substr(0, path.find_last_of('/'));
+        unordered_map<string, Material> materials;
+        for (const string& library : libraries)
+            readMaterials(directory + '/' + library, materials);
+
+        vector<MeshData> result(ranges.size());
+        ParallelFor(pool, result.size(), [&](size_t m)
+        {
+            auto found = materials.find(materialNames[m]);
+            buildMesh(ranges[m], positions, texcoords, normals, found == materials.end() ? Material() : found->second, result[m]);
+        });
+        meshes = std::move(result);
+        return true;
+    }
+
+    // the textures Read would attach to the meshes of the OBJ file at path, relative to its directory, without
+    // parsing any geometry: only the mtllib/usemtl statements and the MTL files they name are read
+    static bool ReadTextures(const string& path, vector<Texture>& textures)
+    {
+        MappedFile file(path);
+        if (!file.isOpen())
+            return false;
+        CountBytesRead(file.size());
+        const char* p = reinterpret_cast<const char*>(file.data());
+        const char* end = p + file.size();
+        vector<string> libraries, used;
+        while (p < end)
+        {
+            const char* lineEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+            if (!lineEnd)
+                lineEnd = end;
+            const char* q = skipSpaces(p, lineEnd);
+            const char* rest;
+            if (keyword(q, lineEnd, "usemtl", rest))
+            {
+                string name = restOfLine(rest, lineEnd);
+                if (std::find(used.begin(), used.end(), name) == used.end())
+                    used.push_back(name);
+            }
+            else if (keyword(q, lineEnd, "mtllib", rest))
+                libraries.push_back(restOfLine(rest, lineEnd));
+            p = lineEnd + 1;
+        }
+
+        string directory = path.substr(0, path.find_last_of('/'));
+        unordered_map<string, Material> materials;
+        for (const string& library : libraries)
+            readMaterials(directory + '/' + library, materials);
+        for (const string& name : used)
+        {
+            auto found = materials.find(name);
+            if (found != materials.end())
+                materialTextures(found->second, textures);
+        }
+        return true;
+    }
+
+private:
+    // one corner of a triangle: 0-based indices into the whole file's arrays once resolved, -1 if absent.
+    // Relative (negative) OBJ indices are kept chunk-local until the chunk's base is known, encoded below -1.
+    struct Corner {
+        int32_t v, vt, vn;
+    };
+
+    struct MaterialRun {
+        string name;
+        size_t firstTriangle;
+    };
+
+    struct Chunk {
+        vector<glm::vec3> positions;
+        vector<glm::vec2> texcoords;
+        vector<glm::vec3> normals;
+        vector<Corner> corners;         // three per triangle
+        vector<MaterialRun> runs;       // usemtl statements, by the first triangle they apply to
+        vector<string> libraries;       // mtllib statements
+    };
+
+    // triangles [first, end) of a chunk
+    struct Range {
+        const Chunk* chunk;
+        size_t first, end;
+    };
+
+    // texture paths of one MTL material, by the Assimp texture type processMesh maps them to
+    struct Material {
+        string diffuse;     // map_Kd
+        string specular;    // map_Ks
+        string height;      // map_bump / bump (aiTextureType_HEIGHT, sampled as texture_normal)
+        string ambient;     // map_Ka (aiTextureType_AMBIENT, sampled as texture_height)
+    };
+
+    static const int32_t LOCAL_BIAS = 1 << 28;
+
+    static int32_t encodeLocal(int64_t local)
+    {
+        return static_cast<int32_t>(-2 - (local + LOCAL_BIAS));
+    }
+
+    // turns a chunk-local or absolute index into an absolute one; false if it points outside the file's arrays
+    static bool resolve(int32_t& index, size_t base, size_t count, bool optional)
+    {
+        if (index == -1)
+            return optional;
+        int64_t absolute = index >= 0 ? int64_t(index) : int64_t(base) + (-2 - int64_t(index)) - LOCAL_BIAS;
+        if (absolute < 0 || absolute >= int64_t(count))
+            return false;
+        index = static_cast<int32_t>(absolute);
+        return true;
+    }
+
+    static const char* skipSpaces(const char* p, const char* end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        return p;
+    }
+
+    static bool parseFloat(const char*& p, const char* end, float& value)
+    {
+        p = skipSpaces(p, end);
+        if (p < end && *p == '+')
+            p++;
+        auto result = std::from_chars(p, end, value);
+        if (result.ec != std::errc())
+            return false;
+        p = result.ptr;
+        return true;
+    }
+
+    // one "v", "v/vt", "v//vn" or "v/vt/vn" group of a face statement
+    static bool parseCorner(const char*& p, const char* end, const Chunk& chunk, Corner& corner)
+    {
+        int32_t* fields[3] = { &corner.v, &corner.vt, &corner.vn };
+        size_t counts[3] = { chunk.positions.size(), chunk.texcoords.size(), chunk.normals.size() };
+        corner.v = corner.vt = corner.vn = -1;
+        for (int f = 0; f < 3; f++)
+        {
+            if (f > 0)
+            {
+                if (p >= end || *p != '/')
+                    break;
+                p++;
+                if (p < end && *p == '/')
+                    continue; // "v//vn"
+            }
+            int value = 0;
+            auto result = std::from_chars(p, end, value);
+            if (result.ec != std::errc() || value == 0)
+                return false;
+            p = result.ptr;
+            *fields[f] = value > 0 ? value - 1 : encodeLocal(int64_t(counts[f]) + value);
+        }
+        return true;
+    }
+
+    // rest of the line with surrounding blanks (and a CR) trimmed
+    static string restOfLine(const char* p, const char* end)
+    {
+        p = skipSpaces(p, end);
+        while (end > p && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+            end--;
+        return string(p, end);
+    }
+
+    static bool keyword(const char* p, const char* end, const char* word, const char*& rest)
+    {
+        size_t length = strlen(word);
+        if (size_t(end - p) < length || memcmp(p, word, length) != 0)
+            return false;
+        if (size_t(end - p) > length && p[length] != ' ' && p[length] != '\t')
+            return false;
+        rest = p + length;
+        return true;
+    }
+
+    static void parseChunk(const char* p, const char* end, Chunk& chunk)
+    {
+        // about 30 bytes per line, and one attribute or face per line
+        size_t estimate = (end - p) / 30;
+        chunk.positions.reserve(estimate / 2);
+        chunk.corners.reserve(estimate * 3 / 2);
+
+        vector<Corner> polygon;
+        while (p < end)
+        {
+            const char* lineEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+            if (!lineEnd)
+                lineEnd = end;
+            const char* q = skipSpaces(p, lineEnd);
+            const char* rest;
+
+            if (keyword(q, lineEnd, "v", rest))
+            {
+                glm::vec3 v(0.0f);
+                if (parseFloat(rest, lineEnd, v.x) && parseFloat(rest, lineEnd, v.y) && parseFloat(rest, lineEnd, v.z))
+                    chunk.positions.push_back(v);
+                else
+                    chunk.positions.push_back(glm::vec3(0.0f)); // keep the numbering of later vertices intact
+            }
+            else if (keyword(q, lineEnd, "vt", rest))
+            {
+                glm::vec2 t(0.0f, 0.0f);
+                parseFloat(rest, lineEnd, t.x);
+                parseFloat(rest, lineEnd, t.y);
+                chunk.texcoords.push_back(t);
+            }
+            else if (keyword(q, lineEnd, "vn", rest))
+            {
+                glm::vec3 n(0.0f);
+                parseFloat(rest, lineEnd, n.x);
+                parseFloat(rest, lineEnd, n.y);
+                parseFloat(rest, lineEnd, n.z);
+                chunk.normals.push_back(n);
+            }
+            else if (keyword(q, lineEnd, "f", rest))
+            {
+                polygon.clear();
+                for (;;)
+                {
+                    rest = skipSpaces(rest, lineEnd);
+                    if (rest >= lineEnd || *rest == '\r' || *rest == '#')
+                        break;
+                    Corner corner;
+                    if (!parseCorner(rest, lineEnd, chunk, corner))
+                    {
+                        polygon.clear(); // malformed face: drop it, like a corner that is out of range
+                        break;
+                    }
+                    polygon.push_back(corner);
+                }
+                // fan triangulation, which is what Assimp's triangulation does for the convex polygons exporters write
+                for (size_t i = 2; i < polygon.size(); i++)
+                {
+                    chunk.corners.push_back(polygon[0]);
+                    chunk.corners.push_back(polygon[i - 1]);
+                    chunk.corners.push_back(polygon[i]);
+                }
+            }
+            else if (keyword(q, lineEnd, "usemtl", rest))
+            {
+                chunk.runs.push_back({ restOfLine(rest, lineEnd), chunk.corners.size() / 3 });
+            }
+            else if (keyword(q, lineEnd, "mtllib", rest))
+            {
+                chunk.libraries.push_back(restOfLine(rest, lineEnd));
+            }
+            // comments, groups, smoothing groups, lines and points don't affect the meshes
+            p = lineEnd + 1;
+        }
+    }
+
+    // texture path of a map_* statement, skipping options such as "-bm 0.5" or "-s 1 1 1"
+    static string texturePath(const char* p, const char* end)
+    {
+        for (;;)
+        {
+            p = skipSpaces(p, end);
+            if (p >= end || *p != '-')
+                break;
+            while (p < end && *p != ' ' && *p != '\t')
+                p++; // the option name
+            // its arguments: numbers, or on/off
+            for (;;)
+            {
+                const char* argument = skipSpaces(p, end);
+                float number;
+                const char* cursor = argument;
+                if (parseFloat(cursor, end, number) && (cursor == end || *cursor == ' ' || *cursor == '\t'))
+                    p = cursor;
+                else if (end - argument >= 3 && strncmp(argument, "off", 3) == 0)
+                    p = argument + 3;
+                else if (end - argument >= 2 && strncmp(argument, "on", 2) == 0)
+                    p = argument + 2;
+                else
+                    break;
+            }
+        }
+        return restOfLine(p, end);
+    }
+
+    static void readMaterials(const string& path, unordered_map<string, Material>& materials)
+    {
+        MappedFile file(path);
+        if (!file.isOpen())
+            return;
+        CountBytesRead(file.size());
+        const char* p = reinterpret_cast<const char*>(file.data());
+        const char* end = p + file.size();
+        Material* current = nullptr;
+        while (p < end)
+        {
+            const char* lineEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+            if (!lineEnd)
+                lineEnd = end;
+            const char* q = skipSpaces(p, lineEnd);
+            const char* rest;
+            if (keyword(q, lineEnd, "newmtl", rest))
+                current = &materials[restOfLine(rest, lineEnd)];
+            else if (current)
+            {
+                // statement names are matched case-insensitively, as exporters disagree on map_Bump/map_bump
+                string word;
+                for (const char* w = q; w < lineEnd && *w != ' ' && *w != '\t'; w++)
+                    word += static_cast<char>(std::tolower(static_cast<unsigned char>(*w)));
+                rest = q + word.size();
+                if (word == "map_kd")
+                    current->diffuse = texturePath(rest, lineEnd);
+                else if (word == "map_ks")
+                    current->specular = texturePath(rest, lineEnd);
+                else if (word == "map_bump" || word == "bump")
+                    current->height = texturePath(rest, lineEnd);
+                else if (word == "map_ka")
+                    current->ambient = texturePath(rest, lineEnd);
+            }
+            p = lineEnd + 1;
+        }
+    }
+
+    struct CornerHash {
+        size_t operator()(const Corner& c) const
+        {
+            return (uint32_t(c.v) * 73856093u) ^ (uint32_t(c.vt) * 19349663u) ^ (uint32_t(c.vn) * 83492791u);
+        }
+    };
+    struct CornerEqual {
+        bool operator()(const Corner& a, const Corner& b) const { return a.v == b.v && a.vt == b.vt && a.vn == b.vn; }
+    };
+
+    // builds one material's mesh: a vertex per distinct v/vt/vn triple, then the attributes Assimp would generate
+    static void buildMesh(const vector<Range>& ranges, const vector<glm::vec3>& positions, const vector<glm::vec2>& texcoords,
+                          const vector<glm::vec3>& normals, const Material& material, MeshData& data)
+    {
+        vector<Vertex>& vertices = data.vertices;
+        vector<unsigned int>& indices = data.indices;
+        unordered_map<Corner, unsigned int, CornerHash, CornerEqual> vertexOf;
+        vector<int32_t> positionOf;
+        bool hasTexcoords = false, missingNormals = false;
+
+        for (const Range& range : ranges)
+            for (size_t i = range.first * 3; i < range.end * 3; i++)
+            {
+                const Corner& corner = range.chunk->corners[i];
+                auto found = vertexOf.emplace(corner, static_cast<unsigned int>(vertices.size()));
+                if (found.second)
+                {
+                    Vertex vertex;
+                    vertex.Position = positions[corner.v];
+                    vertex.Normal = glm::vec3(0.0f);
+                    vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+                    vertex.Tangent = glm::vec3(0.0f);
+                    vertex.Bitangent = glm::vec3(0.0f);
+                    for (int j = 0; j < MAX_BONE_INFLUENCE; j++)
+                    {
+                        vertex.m_BoneIDs[j] = -1;
+                        vertex.m_Weights[j] = 0.0f;
+                    }
+                    if (corner.vt >= 0)
+                    {
+                        // aiProcess_FlipUVs
+                        vertex.TexCoords = glm::vec2(texcoords[corner.vt].x, 1.0f - texcoords[corner.vt].y);
+                        hasTexcoords = true;
+                    }
+                    if (corner.vn >= 0)
+                        vertex.Normal = normals[corner.vn];
+                    else
+                        missingNormals = true;
+                    vertices.push_back(vertex);
+                    positionOf.push_back(corner.v);
+                }
+                indices.push_back(found.first->second);
+            }
+
+        // aiProcess_GenSmoothNormals: vertices without a normal get the area-weighted average of the faces
+        // around their position
+        if (missingNormals)
+        {
+            unordered_map<int32_t, glm::vec3> smooth;
+            for (size_t i = 0; i < indices.size(); i += 3)
+            {
+                const glm::vec3& p0 = vertices[indices[i]].Position;
+                glm::vec3 faceNormal = glm::cross(vertices[indices[i + 1]].Position - p0, vertices[indices[i + 2]].Position - p0);
+                for (int k = 0; k < 3; k++)
+                    smooth[positionOf[indices[i + k]]] += faceNormal;
+            }
+            for (size_t v = 0; v < vertices.size(); v++)
+            {
+                glm::vec3& normal = vertices[v].Normal;
+                if (normal.x == 0.0f && normal.y == 0.0f && normal.z == 0.0f)
+                {
+                    glm::vec3 sum = smooth[positionOf[v]];
+                    normal = glm::length(sum) > 0.0f ? glm::normalize(sum) : glm::vec3(0.0f, 1.0f, 0.0f);
+                }
+            }
+        }
+
+        // aiProcess_CalcTangentSpace, with the same per-face formula and degenerate-UV handling as Assimp
+        if (hasTexcoords)
+        {
+            for (size_t i = 0; i < indices.size(); i += 3)
+            {
+                Vertex& a = vertices[indices[i]];
+                const Vertex& b = vertices[indices[i + 1]];
+                const Vertex& c = vertices[indices[i + 2]];
+                glm::vec3 v = b.Position - a.Position, w = c.Position - a.Position;
+                float sx = b.TexCoords.x - a.TexCoords.x, sy = b.TexCoords.y - a.TexCoords.y;
+                float tx = c.TexCoords.x - a.TexCoords.x, ty = c.TexCoords.y - a.TexCoords.y;
+                float direction = (tx * sy - ty * sx) < 0.0f ? -1.0f : 1.0f;
+                if (sx * ty == sy * tx)
+                {
+                    sx = 0.0f; sy = 1.0f;
+                    tx = 1.0f; ty = 0.0f;
+                }
+                glm::vec3 tangent = (w * sy - v * ty) * direction;
+                glm::vec3 bitangent = (w * sx - v * tx) * direction;
+                for (int k = 0; k < 3; k++)
+                {
+                    vertices[indices[i + k]].Tangent += tangent;
+                    vertices[indices[i + k]].Bitangent += bitangent;
+                }
+            }
+            for (Vertex& vertex : vertices)
+            {
+                glm::vec3 n = vertex.Normal;
+                glm::vec3 t = vertex.Tangent - n * glm::dot(vertex.Tangent, n);
+                glm::vec3 b = vertex.Bitangent - n * glm::dot(vertex.Bitangent, n);
+                t = glm::length(t) > 0.0f ? glm::normalize(t) : glm::vec3(0.0f);
+                b = b - t * glm::dot(b, t);
+                b = glm::length(b) > 0.0f ? glm::normalize(b) : glm::vec3(0.0f);
+                vertex.Tangent = t;
+                vertex.Bitangent = b;
+            }
+        }
+
+        materialTextures(material, data.textures);
+        data.useOwnedArrays();
+    }
+
+    // appends the textures of a material in the same order as processMesh: diffuse, specular, normal, height
+    static void materialTextures(const Material& material, vector<Texture>& textures)
+    {
+        const pair<const string*, const char*> maps[4] = {
+            { &material.diffuse, "texture_diffuse" }, { &material.specular, "texture_specular" },
+            { &material.height, "texture_normal" }, { &material.ambient, "texture_height" } };
+        for (const auto& map : maps)
+            if (!map.first->empty())
+            {
+                Texture texture;
+                texture.id = 0;
+                texture.type = map.second;
+                texture.path = *map.first;
+                textures.push_back(texture);
+            }
+    }
+};
+#endif
@@ -0,0 +1,309 @@
+#ifndef OCCLUSION_CULLER_H
+#define OCCLUSION_CULLER_H
+
+#include <glm.hpp>
+
+#include <bvh.h>
+#include <frustum.h>
+#include <thread_pool.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+using namespace std;
+
+// size of the CPU depth buffer; powers of two, so every pyramid level halves both, the width a multiple of the four
+// pixels the rasterizer writes at once and the height a multiple of the band height
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 128
+// rows rasterized by one job, which also reduces them to the first OCCLUSION_BAND_LEVELS levels of the pyramid
+#define OCCLUSION_BAND_ROWS 16
+#define OCCLUSION_BAND_LEVELS 4
+
+static_assert(OCCLUSION_WIDTH % 4 == 0 && OCCLUSION_HEIGHT % OCCLUSION_BAND_ROWS == 0 && (OCCLUSION_BAND_ROWS >> OCCLUSION_BAND_LEVELS) >= 1,
+    "the occlusion buffer must split into bands that reduce to whole rows");
+
+// Occlusion culling on the CPU, the same under any GL. Large occluders are drawn as low-poly copies (see
+// Model::keepOccluder) into a small depth buffer: addOccluder() transforms and bins their triangles by band of rows,
+// then render() rasterizes the bands on the thread pool, four pixels at a time with SSE2, each band reducing
+// itself to the first levels of a hierarchical-Z pyramid that holds the furthest depth under every texel. visible()
+// then projects a world box, picks the level at which its screen rectangle covers at most 4x4 texels and reports
+// it hidden only if its nearest point lies behind all of them.
+//
+// Depth is sampled at pixel centres, so at this resolution an object peeking out from under an occluder's edge by
+// less than a pixel may be culled. Triangles crossing the near plane are dropped rather than clipped, which only
+// makes the buffer hide less.
+class OcclusionCuller
+{
+public:
+    explicit OcclusionCuller(ThreadPool& pool) : pool(pool), bins(OCCLUSION_HEIGHT / OCCLUSION_BAND_ROWS)
+    {
+        int width = OCCLUSION_WIDTH, height = OCCLUSION_HEIGHT;
+        for (;;)
+        {
+            widths.push_back(width);
+            heights.push_back(height);
+            pyramid.emplace_back(size_t(width) * height, 1.0f);
+            if (width == 1 || height == 1)
+                break;
+            width /= 2;
+            height /= 2;
+        }
+    }
+
+    OcclusionCuller(const OcclusionCuller&) = delete;
+    OcclusionCuller& operator=(const OcclusionCuller&) = delete;
+
+    // starts a frame seen through viewProjection with an empty buffer
+    void begin(const glm::mat4& viewProjection)
+    {
+        start = std::chrono::steady_clock::now();
+        this->viewProjection = viewProjection;
+        triangles.clear();
+        for (vector<uint32_t>& bin : bins)
+            bin.clear();
+        rendered = false;
+        tested = 0;
+        occluded = 0;
+    }
+
+    // queues the triangles of a low-poly mesh placed with model for render()
+    void addOccluder(const vector<glm::vec3>& vertices, const vector<unsigned int>& indices, const glm::mat4& model)
+    {
+        glm::mat4 transform = viewProjection * model;
+        clip.resize(vertices.size());
+        for (size_t v = 0; v < vertices.size(); v++)
+            clip[v] = transform * glm::vec4(vertices[v], 1.0f);
+
+        for (size_t i = 0; i + 2 < indices.size(); i += 3)
+        {
+            const glm::vec4* corners[3] = { &clip[indices[i]], &clip[indices[i + 1]], &clip[indices[i + 2]] };
+            Triangle triangle;
+            bool inFront = true;
+            for (int c = 0; c < 3; c++)
+            {
+                const glm::vec4& p = *corners[c];
+                if (p.z < -p.w || p.w <= 0.0f)
+                {
+                    inFront = false;
+                    break;
+                }
+                triangle.x[c] = (p.x / p.w * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+                triangle.y[c] = (p.y / p.w * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+                triangle.z[c] = p.z / p.w * 0.5f + 0.5f;
+            }
+            if (!inFront)
+                continue;
+            float area = (triangle.x[1] - triangle.x[0]) * (triangle.y[2] - triangle.y[0]) - (triangle.x[2] - triangle.x[0]) * (triangle.y[1] - triangle.y[0]);
+            if (area == 0.0f)
+                continue;
+            // both faces are drawn; the edge functions below want the corners counter-clockwise
+            if (area < 0.0f)
+            {
+                std::swap(triangle.x[1], triangle.x[2]);
+                std::swap(triangle.y[1], triangle.y[2]);
+                std::swap(triangle.z[1], triangle.z[2]);
+            }
+
+            // the pixels whose centres the triangle's bounding box covers
+            float lowX = std::min(triangle.x[0], std::min(triangle.x[1], triangle.x[2]));
+            float highX = std::max(triangle.x[0], std::max(triangle.x[1], triangle.x[2]));
+            float lowY = std::min(triangle.y[0], std::min(triangle.y[1], triangle.y[2]));
+            float highY = std::max(triangle.y[0], std::max(triangle.y[1], triangle.y[2]));
+            if (highX < 0.5f || lowX > OCCLUSION_WIDTH - 0.5f || highY < 0.5f || lowY > OCCLUSION_HEIGHT - 0.5f)
+                continue;
+            triangle.left = std::max(0, static_cast<int>(std::ceil(lowX - 0.5f)));
+            triangle.right = std::min(OCCLUSION_WIDTH - 1, static_cast<int>(std::floor(highX - 0.5f)));
+            triangle.top = std::max(0, static_cast<int>(std::ceil(lowY - 0.5f)));
+            triangle.bottom = std::min(OCCLUSION_HEIGHT - 1, static_cast<int>(std::floor(highY - 0.5f)));
+            if (triangle.left > triangle.right || triangle.top > triangle.bottom)
+                continue;
+
+            uint32_t index = static_cast<uint32_t>(triangles.size());
+            triangles.push_back(triangle);
+            for (int band = triangle.top / OCCLUSION_BAND_ROWS; band <= triangle.bottom / OCCLUSION_BAND_ROWS; band++)
+                bins[band].push_back(index);
+        }
+    }
+
+    // rasterizes the queued triangles and builds the pyramid
+    void render()
+    {
+        pool.parallelFor(bins.size(), [this](size_t band) { renderBand(static_cast<int>(band)); });
+        for (size_t level = OCCLUSION_BAND_LEVELS + 1; level < pyramid.size(); level++)
+            reduce(level, 0, heights[level]);
+        rendered = true;
+        milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // false if the box is certainly hidden behind the occluders; true if it may be seen, or can't be judged because
+    // it reaches in front of the near plane. Safe to call from several threads after render().
+    bool visible(const Bounds& box) const
+    {
+        if (!rendered || triangles.empty())
+            return true;
+        tested++;
+        float lowX = 1.0f, highX = -1.0f, lowY = 1.0f, highY = -1.0f, nearest = 1.0f;
+        for (int corner = 0; corner < 8; corner++)
+        {
+            glm::vec3 position(corner & 1 ? box.high.x : box.low.x, corner & 2 ? box.high.y : box.low.y, corner & 4 ? box.high.z : box.low.z);
+            glm::vec4 p = viewProjection * glm::vec4(position, 1.0f);
+            if (p.z < -p.w || p.w <= 0.0f)
+                return true;
+            glm::vec3 ndc = glm::vec3(p) / p.w;
+            lowX = std::min(lowX, ndc.x);
+            highX = std::max(highX, ndc.x);
+            lowY = std::min(lowY, ndc.y);
+            highY = std::max(highY, ndc.y);
+            nearest = std::min(nearest, ndc.z);
+        }
+        // off screen: the frustum's to decide
+        if (highX < -1.0f || lowX > 1.0f || highY < -1.0f || lowY > 1.0f)
+            return true;
+        nearest = nearest * 0.5f + 0.5f;
+        int left = pixel(lowX, OCCLUSION_WIDTH), right = pixel(highX, OCCLUSION_WIDTH);
+        int top = pixel(lowY, OCCLUSION_HEIGHT), bottom = pixel(highY, OCCLUSION_HEIGHT);
+
+        size_t level = 0;
+        while (level + 1 < pyramid.size() && ((right >> level) - (left >> level) > 3 || (bottom >> level) - (top >> level) > 3))
+            level++;
+        const vector<float>& depths = pyramid[level];
+        for (int y = top >> level; y <= bottom >> level; y++)
+            for (int x = left >> level; x <= right >> level; x++)
+                if (depths[size_t(y) * widths[level] + x] >= nearest)
+                    return true;
+        occluded++;
+        return false;
+    }
+
+    // the finished depth buffer, OCCLUSION_WIDTH x OCCLUSION_HEIGHT with the bottom row first, 0 near and 1 far
+    const vector<float>& depthBuffer() const { return pyramid[0]; }
+
+    void report(ostream& out) const
+    {
+        out << "OCCLUSION:: " << triangles.size() << " occluder triangles in " << OCCLUSION_WIDTH << "x" << OCCLUSION_HEIGHT << " on "
+            << pool.size() + 1 << " threads, " << std::fixed << std::setprecision(3) << milliseconds << " ms; "
+            << occluded << " of " << tested << " boxes tested hidden" << endl;
+    }
+
+private:
+    // screen-space corners, pixel units with depth in [0, 1], and the pixels its bounding box covers
+    struct Triangle {
+        float x[3], y[3], z[3];
+        int left, right, top, bottom;
+    };
+
+    ThreadPool& pool;
+    glm::mat4 viewProjection = glm::mat4(1.0f);
+    vector<glm::vec4> clip;                 // addOccluder's transformed vertices
+    vector<Triangle> triangles;
+    vector<vector<uint32_t>> bins;          // per band, the triangles reaching into it
+    vector<vector<float>> pyramid;          // level 0 is the depth buffer
+    vector<int> widths, heights;
+    bool rendered = false;
+    std::chrono::steady_clock::time_point start;
+    double milliseconds = 0.0;
+    mutable std::atomic<size_t> tested{ 0 }, occluded{ 0 };
+
+    static int pixel(float ndc, int size)
+    {
+        return std::min(size - 1, std::max(0, static_cast<int>(std::floor((ndc * 0.5f + 0.5f) * size))));
+    }
+
+    void renderBand(int band)
+    {
+        int firstRow = band * OCCLUSION_BAND_ROWS, endRow = firstRow + OCCLUSION_BAND_ROWS;
+        float* depths = pyramid[0].data();
+        std::fill(depths + size_t(firstRow) * OCCLUSION_WIDTH, depths + size_t(endRow) * OCCLUSION_WIDTH, 1.0f);
+        for (uint32_t index : bins[band])
+            rasterize(triangles[index], std::max(firstRow, triangles[index].top), std::min(endRow - 1, triangles[index].bottom));
+        for (int level = 1; level <= OCCLUSION_BAND_LEVELS && level < static_cast<int>(pyramid.size()); level++)
+            reduce(level, firstRow >> level, endRow >> level);
+    }
+
+    // keeps the nearer of the buffer and the triangle at every pixel centre inside it, rows top to bottom
+    void rasterize(const Triangle& t, int top, int bottom)
+    {
+        // edge i runs from corner i to the next; its function is positive on the inside
+        float a[3], b[3], c[3];
+        for (int i = 0; i < 3; i++)
+        {
+            int j = (i + 1) % 3;
+            a[i] = t.y[i] - t.y[j];
+            b[i] = t.x[j] - t.x[i];
+            c[i] = t.x[i] * t.y[j] - t.x[j] * t.y[i];
+        }
+        // depth is affine in screen space: the corners' depths weighted by the opposite edges' functions
+        float area = c[0] + c[1] + c[2];
+        float za = (t.z[0] * a[1] + t.z[1] * a[2] + t.z[2] * a[0]) / area;
+        float zb = (t.z[0] * b[1] + t.z[1] * b[2] + t.z[2] * b[0]) / area;
+        float zc = (t.z[0] * c[1] + t.z[1] * c[2] + t.z[2] * c[0]) / area;
+        int left = t.left & ~3;
+        float* depths = pyramid[0].data();
+#ifdef FRUSTUM_SSE2
+        const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f), four = _mm_set1_ps(4.0f), zero = _mm_setzero_ps();
+        __m128 ea[3], za4 = _mm_set1_ps(za);
+        for (int i = 0; i < 3; i++)
+            ea[i] = _mm_set1_ps(a[i]);
+        for (int y = top; y <= bottom; y++)
+        {
+            float centerY = y + 0.5f;
+            __m128 x = _mm_add_ps(_mm_set1_ps(static_cast<float>(left)), offsets);
+            __m128 e0 = _mm_add_ps(_mm_mul_ps(ea[0], x), _mm_set1_ps(b[0] * centerY + c[0]));
+            __m128 e1 = _mm_add_ps(_mm_mul_ps(ea[1], x), _mm_set1_ps(b[1] * centerY + c[1]));
+            __m128 e2 = _mm_add_ps(_mm_mul_ps(ea[2], x), _mm_set1_ps(b[2] * centerY + c[2]));
+            __m128 z = _mm_add_ps(_mm_mul_ps(za4, x), _mm_set1_ps(zb * centerY + zc));
+            __m128 step0 = _mm_mul_ps(ea[0], four), step1 = _mm_mul_ps(ea[1], four), step2 = _mm_mul_ps(ea[2], four), stepZ = _mm_mul_ps(za4, four);
+            float* row = depths + size_t(y) * OCCLUSION_WIDTH;
+            for (int px = left; px <= t.right; px += 4)
+            {
+                __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+                if (_mm_movemask_ps(inside))
+                {
+                    __m128 current = _mm_loadu_ps(row + px);
+                    __m128 nearer = _mm_min_ps(current, z);
+                    _mm_storeu_ps(row + px, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, current)));
+                }
+                e0 = _mm_add_ps(e0, step0);
+                e1 = _mm_add_ps(e1, step1);
+                e2 = _mm_add_ps(e2, step2);
+                z = _mm_add_ps(z, stepZ);
+            }
+        }
+#else
+        for (int y = top; y <= bottom; y++)
+        {
+            float centerY = y + 0.5f;
+            float* row = depths + size_t(y) * OCCLUSION_WIDTH;
+            for (int px = left; px <= t.right; px++)
+            {
+                float centerX = px + 0.5f;
+                if (a[0] * centerX + b[0] * centerY + c[0] >= 0.0f && a[1] * centerX + b[1] * centerY + c[1] >= 0.0f &&
+                    a[2] * centerX + b[2] * centerY + c[2] >= 0.0f)
+                    row[px] = std::min(row[px], za * centerX + zb * centerY + zc);
+            }
+        }
+#endif
+    }
+
+    // fills rows [firstRow, endRow) of a pyramid level with the furthest depth of the 2x2 texels under each
+    void reduce(size_t level, int firstRow, int endRow)
+    {
+        const float* below = pyramid[level - 1].data();
+        float* depths = pyramid[level].data();
+        int width = widths[level], belowWidth = widths[level - 1];
+        for (int y = firstRow; y < endRow; y++)
+        {
+            const float* upper = below + size_t(2 * y) * belowWidth;
+            const float* lower = upper + belowWidth;
+            for (int x = 0; x < width; x++)
+                depths[size_t(y) * width + x] = std::max(std::max(upper[2 * x], upper[2 * x + 1]), std::max(lower[2 * x], lower[2 * x + 1]));
+        }
+    }
+};
+#endif
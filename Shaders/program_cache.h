@@ -0,0 +1,151 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+
+#include <gl_ext.h>
+#include <hash.h>
+#include <load_profiler.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Linked program binaries from earlier runs, one file per program in PROGRAM_CACHE_DIRECTORY named after its key.
+// The key hashes every stage's source together with the GL vendor, renderer and version strings, so a shader
+// edit or a driver update simply misses. Drivers may still reject a binary they wrote themselves, in which case
+// the caller compiles from source and stores a fresh one. Without ARB_get_program_binary nothing is cached.
+//
+// file layout: ProgramCacheHeader, then binaryLength bytes of driver-specific binary
+#define PROGRAM_CACHE_MAGIC 0x50424B50u // "PKBP"
+#define PROGRAM_CACHE_VERSION 1u
+#define PROGRAM_CACHE_DIRECTORY "shader_cache"
+
+struct ProgramCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t binaryFormat;
+    uint32_t binaryLength;
+};
+
+class ProgramCache
+{
+public:
+    // key for a program built from the given stage sources on the current context; 0 when caching is unavailable
+    static uint64_t Key(const std::vector<std::string>& sources)
+    {
+        if (!glGetProgramBinaryExt)
+            return 0;
+        uint32_t salt = PROGRAM_CACHE_VERSION;
+        uint64_t hash = Fnv1a64(&salt, sizeof(salt));
+        for (const std::string& source : sources)
+        {
+            // hash the length too, so moving text from one stage to the next changes the key
+            uint64_t length = source.size();
+            hash = Fnv1a64(&length, sizeof(length), hash);
+            hash = Fnv1a64(source.data(), source.size(), hash);
+        }
+        for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+        {
+            const char* value = reinterpret_cast<const char*>(glGetString(name));
+            if (value)
+                hash = Fnv1a64(value, strlen(value) + 1, hash);
+        }
+        return hash == 0 ? 1 : hash;
+    }
+
+    // path of the binary belonging to key
+    static std::string CachePath(uint64_t key)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+        return std::string(PROGRAM_CACHE_DIRECTORY) + '/' + name;
+    }
+
+    // loads the cached binary for key into program; false if there is none or the driver rejected it, after
+    // which program is in an unlinked state and should be deleted
+    static bool Load(uint64_t key, GLuint program)
+    {
+        if (key == 0 || !glProgramBinaryExt)
+            return false;
+        std::ifstream in(CachePath(key), std::ios::binary);
+        ProgramCacheHeader header;
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != PROGRAM_CACHE_MAGIC ||
+            header.version != PROGRAM_CACHE_VERSION || header.key != key || header.binaryLength == 0)
+            return false;
+        std::vector<char> binary(header.binaryLength);
+        if (!in.read(binary.data(), binary.size()))
+            return false;
+        CountBytesRead(sizeof(header) + binary.size());
+
+        glProgramBinaryExt(program, header.binaryFormat, binary.data(), static_cast<GLsizei>(binary.size()));
+        GLint linked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        return linked == GL_TRUE;
+    }
+
+    // call before linking a program that is going to be stored, so the driver keeps its binary retrievable
+    static void PrepareForStore(GLuint program)
+    {
+        if (glProgramParameteriExt)
+            glProgramParameteriExt(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    // saves the binary of a successfully linked program under key; goes through a temporary file like MeshCache::Store
+    static bool Store(uint64_t key, GLuint program)
+    {
+        if (key == 0 || !glGetProgramBinaryExt)
+            return false;
+        GLint linked = GL_FALSE, length = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (linked != GL_TRUE || length <= 0)
+            return false;
+
+        std::vector<char> binary(length);
+        GLsizei written = 0;
+        GLenum format = 0;
+        glGetProgramBinaryExt(program, length, &written, &format, binary.data());
+        if (written <= 0)
+            return false;
+
+        ProgramCacheHeader header;
+        header.magic = PROGRAM_CACHE_MAGIC;
+        header.version = PROGRAM_CACHE_VERSION;
+        header.key = key;
+        header.binaryFormat = format;
+        header.binaryLength = static_cast<uint32_t>(written);
+
+        std::error_code error;
+        std::filesystem::create_directories(PROGRAM_CACHE_DIRECTORY, error);
+        std::string finalPath = CachePath(key);
+        std::string tempPath = finalPath + ".tmp";
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(binary.data(), written);
+        out.close();
+        if (!out)
+        {
+            std::remove(tempPath.c_str());
+            return false;
+        }
+
+        std::remove(finalPath.c_str()); // rename doesn't replace an existing file on Windows
+        if (std::rename(tempPath.c_str(), finalPath.c_str()) != 0)
+        {
+            std::cout << "ERROR::PROGRAM_CACHE:: could not write " << finalPath << std::endl;
+            std::remove(tempPath.c_str());
+            return false;
+        }
+        return true;
+    }
+};
+#endif
@@ -0,0 +1,516 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+#include <glm.hpp>
+
+#include <bvh.h>
+#include <frustum.h>
+#include <gl_state.h>
+#include <shader_s.h>
+#include <material.h>
+#include <thread_pool.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <vector>
+using namespace std;
+
+// attribute locations 7 to 10 hold the per-instance model matrix of instanced draws, one column each; 0 to 6 are
+// the vertex attributes (see SetVertexAttributes)
+#define INSTANCE_MATRIX_LOCATION 7
+
+// passes run in this order; opaque draws go front to back, transparent ones back to front
+enum class RenderPass : unsigned int { Opaque = 0, Transparent = 1 };
+
+// everything needed to issue one draw: drawCount index ranges of a vertex array (counts[i] indices starting at
+// offsets[i], offset by baseVertices[i]) with the material's textures. The arrays must stay valid until execute().
+struct DrawCommand {
+    RenderPass pass = RenderPass::Opaque;
+    GLenum mode = GL_TRIANGLES;
+    Shader* shader = nullptr;
+    Material* material = nullptr;
+    unsigned int vao = 0;
+    GLenum indexType = GL_UNSIGNED_INT;
+    GLsizei drawCount = 0;
+    const GLsizei* counts = nullptr;
+    const void* const* offsets = nullptr;
+    const GLint* baseVertices = nullptr;
+    glm::vec3 boundsCenter = glm::vec3(0.0f);  // sphere around what the command draws, in model space; with a
+    float boundsRadius = -1.0f;                 // negative radius the command is never culled
+};
+
+// what the last execute() did. Issuing the commands one by one would have changed every piece of state for
+// every command; the difference is what sorting saved.
+struct RenderQueueStats {
+    size_t draws = 0;
+    size_t shaderChanges = 0;
+    size_t materialChanges = 0;
+    size_t vaoChanges = 0;
+    size_t transformChanges = 0;
+    size_t drawCalls = 0;           // GL draw calls made, instanced ones included
+    size_t instancedDraws = 0;      // instanced draw calls, and the placements they drew
+    size_t instances = 0;
+    size_t visible = 0;             // submitted commands that passed frustum culling, and those that didn't
+    size_t culled = 0;
+
+    size_t shaderChangesAvoided() const { return draws - shaderChanges; }
+    size_t materialChangesAvoided() const { return draws - materialChanges; }
+    size_t vaoChangesAvoided() const { return draws - vaoChanges; }
+    size_t transformChangesAvoided() const { return draws - transformChanges; }
+    size_t changesAvoided() const { return shaderChangesAvoided() + materialChangesAvoided() + vaoChangesAvoided() + transformChangesAvoided(); }
+};
+
+
+// The draws one thread records for a frame, with their sort keys and world bounding spheres. A RenderQueue holds
+// one per thread building the frame (see RenderQueue::list); every list has a single writer, so recording takes
+// no locks.
+class CommandList
+{
+public:
+    // stores a model matrix for the frame; the returned index is passed to submit for every draw that uses it
+    unsigned int transform(const glm::mat4& model)
+    {
+        transforms.push_back(model);
+        return static_cast<unsigned int>(transforms.size() - 1);
+    }
+
+    void submit(const DrawCommand& command, unsigned int transform)
+    {
+        const glm::mat4& model = transforms[transform];
+        glm::vec3 center = glm::vec3(model * glm::vec4(command.boundsCenter, 1.0f));
+        if (command.boundsRadius < 0.0f)
+            spheres.push(center, std::numeric_limits<float>::infinity());
+        else
+        {
+            spheres.push(center, command.boundsRadius * MaxAxisScale(model));
+        }
+
+        float distance = glm::length(center - camera);
+        uint64_t depth = static_cast<uint64_t>(std::min(distance * depthScale, static_cast<float>(DEPTH_MASK)));
+        if (command.pass == RenderPass::Transparent)
+            depth = DEPTH_MASK - depth;
+
+        uint64_t key = static_cast<uint64_t>(command.pass) << 60
+            | static_cast<uint64_t>(command.shader->ID & 0xFFu) << 52
+            | static_cast<uint64_t>(command.material->key() & 0xFFFFu) << 36
+            | static_cast<uint64_t>(command.vao & 0xFFFFu) << 20
+            | depth;
+        items.push_back(Item{ key, static_cast<uint32_t>(commands.size()), list });
+        commands.push_back(command);
+        commandTransforms.push_back(transform);
+    }
+
+    size_t size() const { return commands.size(); }
+
+private:
+    friend class RenderQueue;
+
+    static const uint64_t DEPTH_MASK = (1u << 20) - 1;
+
+    // a command's sort key, with where to find the command
+    struct Item {
+        uint64_t key;
+        uint32_t command;
+        uint32_t list;
+    };
+
+    uint32_t list = 0;
+    glm::vec3 camera = glm::vec3(0.0f);
+    float depthScale = 0.0f;
+    vector<DrawCommand> commands;
+    vector<unsigned int> commandTransforms;     // per command, its index into transforms
+    vector<glm::mat4> transforms;
+    vector<Item> items;
+    vector<Item> scratch;
+    SphereBounds spheres;                       // per command, its world-space bounding sphere
+    vector<uint8_t> visibility;                 // per command, the result of the frustum test
+    size_t visible = 0;
+    size_t culled = 0;
+    bool finished = false;
+
+    void begin(uint32_t index, const glm::vec3& cameraPosition, float scale)
+    {
+        list = index;
+        camera = cameraPosition;
+        depthScale = scale;
+        commands.clear();
+        commandTransforms.clear();
+        transforms.clear();
+        items.clear();
+        spheres.clear();
+        visible = culled = 0;
+        finished = false;
+    }
+
+    void finish(const Frustum& frustum, bool culling)
+    {
+        cull(frustum, culling);
+        sort();
+        finished = true;
+    }
+
+    // drops the items whose sphere lies outside the frustum
+    void cull(const Frustum& frustum, bool culling)
+    {
+        if (!culling)
+        {
+            visible = items.size();
+            return;
+        }
+        visibility.resize(spheres.size());
+        visible = CullSpheres(frustum, spheres, visibility.data());
+        culled = items.size() - visible;
+        if (culled == 0)
+            return;
+        // items are still in submission order here, so item i belongs to command i
+        size_t kept = 0;
+        for (size_t i = 0; i < items.size(); i++)
+            if (visibility[i])
+                items[kept++] = items[i];
+        items.resize(kept);
+    }
+
+    // least significant digit radix sort on the keys, a byte per pass. The histograms of all eight bytes are
+    // counted in one sweep, and passes where every key has the same byte are skipped. Stable, so draws with equal
+    // keys keep their submission order.
+    void sort()
+    {
+        if (items.size() < 2)
+            return;
+        size_t counts[8][256] = {};
+        for (const Item& item : items)
+            for (unsigned int digit = 0; digit < 8; digit++)
+                counts[digit][(item.key >> (digit * 8)) & 0xFF]++;
+
+        scratch.resize(items.size());
+        for (unsigned int digit = 0; digit < 8; digit++)
+        {
+            size_t* count = counts[digit];
+            if (count[(items[0].key >> (digit * 8)) & 0xFF] == items.size())
+                continue;
+            size_t offset = 0;
+            for (unsigned int bucket = 0; bucket < 256; bucket++)
+            {
+                size_t size = count[bucket];
+                count[bucket] = offset;
+                offset += size;
+            }
+            for (const Item& item : items)
+                scratch[count[(item.key >> (digit * 8)) & 0xFF]++] = item;
+            items.swap(scratch);
+        }
+    }
+};
+
+// Draws collected over a frame and issued together, ordered so that state changes as rarely as possible.
+// Every submit packs the draw's state into a 64-bit key, most significant first:
+//
+//   pass (4 bits) | shader (8) | material (16) | vertex array (16) | depth bucket (20)
+//
+// The keys are radix sorted before execute() walks them, changing only what differs from the previous draw.
+// Shader and vertex array fields hold the GL names, the material field Material::key(); ids that don't fit are
+// truncated, which costs some sorting quality but never correctness, since execute() compares the real state.
+// The model matrix of each draw goes to the shader's "model" uniform.
+//
+// Placements of the same model sort next to each other, since their keys differ in the depth bucket at most.
+// For a shader registered with instanceWith, such a run of identical commands becomes one instanced draw per
+// mesh range: the run's matrices are copied to the instance buffer, uploaded once for the whole frame, and the
+// instanced variant of the shader reads them as a vertex attribute. A model placed a thousand times then costs
+// as many draw calls as one placed once.
+//
+// Commands are recorded into one or more CommandLists, one per thread building the frame. finish() tests a list's
+// world-space bounding spheres against the view frustum in one SIMD pass over a structure of arrays (see
+// CullSpheres), drops the commands outside and sorts the rest; it runs on the thread that recorded the list, or in
+// execute() for lists nobody finished. execute() then merges the sorted lists and is left with the GL calls, the
+// instance matrices being copied on the thread pool if it is given one. The queue keeps its arrays from frame to
+// frame, so once they have grown to a frame's size it allocates nothing.
+class RenderQueue
+{
+public:
+    // starts a frame recorded into lists command lists; depth buckets measure the distance from cameraPosition in
+    // steps of farPlane / 2^20, and commands are culled against the frustum of viewProjection
+    void begin(const glm::vec3& cameraPosition, float farPlane, const glm::mat4& viewProjection, unsigned int lists = 1)
+    {
+        float depthScale = farPlane > 0.0f ? static_cast<float>(CommandList::DEPTH_MASK) / farPlane : 0.0f;
+        frustum = Frustum::FromMatrix(viewProjection);
+        if (commandLists.size() < lists)
+            commandLists.resize(lists);
+        activeLists = std::max(1u, lists);
+        for (unsigned int i = 0; i < activeLists; i++)
+            commandLists[i].begin(i, cameraPosition, depthScale);
+        items.clear();
+    }
+
+    // frustum culling is on unless switched off here, e.g. to compare timings
+    void setCulling(bool enabled) { culling = enabled; }
+
+    // the list a thread records into; index is below the count given to begin, and no two threads share one
+    CommandList& list(unsigned int index = 0) { return commandLists[index]; }
+
+    // culls and sorts a list once its thread has recorded everything; safe to call for different lists at once
+    void finish(unsigned int index)
+    {
+        commandLists[index].finish(frustum, culling);
+    }
+
+    // sorts and issues the frame's draws through GLState; transparent ones are alpha blended. Consecutive opaque
+    // commands that differ only in their model matrix are drawn instanced where the shader has a variant for it.
+    void execute(ThreadPool* pool = nullptr)
+    {
+        lastStats = RenderQueueStats();
+        for (unsigned int i = 0; i < activeLists; i++)
+        {
+            if (!commandLists[i].finished)
+                finish(i);
+            lastStats.visible += commandLists[i].visible;
+            lastStats.culled += commandLists[i].culled;
+        }
+        merge();
+        lastStats.draws = items.size();
+        collectInstances(pool);
+
+        GLState& state = GLState::Instance();
+        bool passSet = false;
+        RenderPass pass = RenderPass::Opaque;
+        Shader* shader = nullptr;
+        Uniform<glm::mat4> model;
+        unsigned int material = 0, vao = 0;
+        const glm::mat4* transform = nullptr;
+        bool materialBound = false, vaoBound = false;
+        for (const Run& run : runs)
+        {
+            const DrawCommand& command = commandOf(items[run.first]);
+            if (!passSet || command.pass != pass)
+            {
+                pass = command.pass;
+                passSet = true;
+                state.setBlend(pass == RenderPass::Transparent);
+                if (pass == RenderPass::Transparent)
+                    state.setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            }
+            Shader* runShader = run.instanced ? instancedVariant(command.shader) : command.shader;
+            if (runShader != shader)
+            {
+                shader = runShader;
+                shader->use();
+                model = shader->modelUniform;
+                lastStats.shaderChanges++;
+                // uniforms and sampler setup belong to the program
+                materialBound = false;
+                transform = nullptr;
+            }
+            if (!materialBound || command.material->key() != material)
+            {
+                command.material->Bind(*shader);
+                material = command.material->key();
+                materialBound = true;
+                lastStats.materialChanges++;
+            }
+            if (!vaoBound || command.vao != vao)
+            {
+                state.bindVertexArray(command.vao);
+                vao = command.vao;
+                vaoBound = true;
+                lastStats.vaoChanges++;
+            }
+
+            if (run.instanced)
+            {
+                GLsizei instances = static_cast<GLsizei>(run.last - run.first);
+                setInstanceAttributes(run.firstInstance);
+                for (GLsizei i = 0; i < command.drawCount; i++)
+                    glDrawElementsInstancedBaseVertex(command.mode, command.counts[i], command.indexType, command.offsets[i], instances, command.baseVertices[i]);
+                lastStats.drawCalls += command.drawCount;
+                lastStats.instancedDraws += command.drawCount;
+                lastStats.instances += instances;
+                continue;
+            }
+
+            const glm::mat4* commandTransform = &transformOf(items[run.first]);
+            if (commandTransform != transform)
+            {
+                model.set(*commandTransform);
+                transform = commandTransform;
+                lastStats.transformChanges++;
+            }
+            if (command.drawCount == 1)
+                glDrawElementsBaseVertex(command.mode, command.counts[0], command.indexType, command.offsets[0], command.baseVertices[0]);
+            else
+                glMultiDrawElementsBaseVertex(command.mode, command.counts, command.indexType, command.offsets, command.drawCount, command.baseVertices);
+            lastStats.drawCalls++;
+        }
+        if (passSet && pass == RenderPass::Transparent)
+            state.setBlend(false);
+    }
+
+    // draws of shader that repeat with only their model matrix changing are done with instanced instead, which
+    // takes the matrices from the mat4 attribute at INSTANCE_MATRIX_LOCATION
+    void instanceWith(Shader& shader, Shader& instanced)
+    {
+        for (InstancedVariant& variant : variants)
+            if (variant.shader == &shader)
+            {
+                variant.instanced = &instanced;
+                return;
+            }
+        variants.push_back(InstancedVariant{ &shader, &instanced });
+    }
+
+    // releases the instance buffer; call while the context is still current
+    void release()
+    {
+        glDeleteBuffers(1, &instanceBuffer);
+        instanceBuffer = 0;
+        instanceCapacity = 0;
+    }
+
+    const RenderQueueStats& stats() const { return lastStats; }
+
+    void report(ostream& out) const
+    {
+        out << "RENDER_QUEUE:: " << lastStats.draws << " draws, " << lastStats.shaderChanges << " shader / "
+            << lastStats.materialChanges << " material / " << lastStats.vaoChanges << " vertex array / "
+            << lastStats.transformChanges << " transform changes, " << lastStats.changesAvoided() << " avoided; "
+            << lastStats.drawCalls << " draw calls, " << lastStats.instancedDraws << " of them instanced for " << lastStats.instances << " placements; "
+            << lastStats.visible << " visible, " << lastStats.culled << " culled" << endl;
+    }
+
+private:
+    typedef CommandList::Item Item;
+
+    // instanced runs copied per job when the matrices are filled on a thread pool
+    static const size_t RUNS_PER_JOB = 64;
+
+    vector<CommandList> commandLists;
+    unsigned int activeLists = 1;
+    vector<Item> items;                 // the finished lists' items merged in key order
+    vector<Item> scratch;
+    RenderQueueStats lastStats;
+
+    // consecutive sorted items drawn together: either a single command, or several drawn instanced with their
+    // matrices at firstInstance in the instance buffer
+    struct Run {
+        size_t first;
+        size_t last;
+        bool instanced;
+        size_t firstInstance;
+    };
+
+    struct InstancedVariant {
+        Shader* shader;
+        Shader* instanced;
+    };
+
+    Frustum frustum;
+    bool culling = true;
+
+    const DrawCommand& commandOf(const Item& item) const { return commandLists[item.list].commands[item.command]; }
+
+    const glm::mat4& transformOf(const Item& item) const
+    {
+        const CommandList& list = commandLists[item.list];
+        return list.transforms[list.commandTransforms[item.command]];
+    }
+
+    // merges the sorted lists one after the other into items; equal keys keep the order of the lists
+    void merge()
+    {
+        items = commandLists[0].items;
+        for (unsigned int i = 1; i < activeLists; i++)
+        {
+            const vector<Item>& next = commandLists[i].items;
+            if (next.empty())
+                continue;
+            scratch.resize(items.size() + next.size());
+            std::merge(items.begin(), items.end(), next.begin(), next.end(), scratch.begin(),
+                [](const Item& a, const Item& b) { return a.key < b.key; });
+            items.swap(scratch);
+        }
+    }
+
+    vector<Run> runs;
+    vector<InstancedVariant> variants;
+    vector<glm::mat4> instanceMatrices;
+    unsigned int instanceBuffer = 0;
+    size_t instanceCapacity = 0;        // in matrices
+
+    Shader* instancedVariant(Shader* shader) const
+    {
+        for (const InstancedVariant& variant : variants)
+            if (variant.shader == shader)
+                return variant.instanced;
+        return nullptr;
+    }
+
+    // the same draw of the same mesh ranges; only the transforms (and so the depth) may differ
+    static bool SameDraw(const DrawCommand& a, const DrawCommand& b)
+    {
+        return a.pass == b.pass && a.mode == b.mode && a.shader == b.shader && a.material == b.material && a.vao == b.vao &&
+            a.indexType == b.indexType && a.drawCount == b.drawCount && a.counts == b.counts && a.offsets == b.offsets &&
+            a.baseVertices == b.baseVertices;
+    }
+
+    // splits the sorted items into runs, copies the matrices of the instanced ones and uploads them in one go
+    void collectInstances(ThreadPool* pool)
+    {
+        runs.clear();
+        size_t instances = 0;
+        for (size_t first = 0; first < items.size();)
+        {
+            const DrawCommand& command = commandOf(items[first]);
+            size_t last = first + 1;
+            if (command.pass == RenderPass::Opaque && instancedVariant(command.shader))
+                while (last < items.size() && SameDraw(command, commandOf(items[last])))
+                    last++;
+            Run run{ first, last, last - first > 1, instances };
+            if (run.instanced)
+                instances += last - first;
+            runs.push_back(run);
+            first = last;
+        }
+        if (instances == 0)
+            return;
+
+        instanceMatrices.resize(instances);
+        auto copy = [this](size_t job)
+        {
+            for (size_t r = job * RUNS_PER_JOB; r < std::min(runs.size(), (job + 1) * RUNS_PER_JOB); r++)
+                if (runs[r].instanced)
+                    for (size_t i = runs[r].first; i < runs[r].last; i++)
+                        instanceMatrices[runs[r].firstInstance + i - runs[r].first] = transformOf(items[i]);
+        };
+        size_t jobs = (runs.size() + RUNS_PER_JOB - 1) / RUNS_PER_JOB;
+        if (pool && jobs > 1)
+            pool->parallelFor(jobs, copy);
+        else
+            for (size_t job = 0; job < jobs; job++)
+                copy(job);
+
+        if (!instanceBuffer)
+            glGenBuffers(1, &instanceBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        if (instanceMatrices.size() > instanceCapacity)
+            instanceCapacity = std::max(instanceMatrices.size(), instanceCapacity * 2);
+        // fresh storage every frame, so writing it doesn't wait for the GPU to finish reading last frame's
+        glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(glm::mat4), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, instanceMatrices.size() * sizeof(glm::mat4), instanceMatrices.data());
+    }
+
+    // points the bound vertex array's instance matrix attribute at the matrices from firstInstance on. There is no
+    // base instance in GL 3.3, so the offset goes into the attribute pointer instead.
+    void setInstanceAttributes(size_t firstInstance)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        for (GLuint column = 0; column < 4; column++)
+        {
+            GLuint location = INSTANCE_MATRIX_LOCATION + column;
+            glEnableVertexAttribArray(location);
+            glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(firstInstance * sizeof(glm::mat4) + column * sizeof(glm::vec4)));
+            glVertexAttribDivisor(location, 1);
+        }
+    }
+};
+#endif
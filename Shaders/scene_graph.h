@@ -0,0 +1,85 @@
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include <glm.hpp>
+
+#include <cstdint>
+#include <vector>
+using namespace std;
+
+class Model;
+
+// Placements of the scene as a hierarchy of nodes, each with a local transform relative to its parent and
+// optionally a Model drawn at its world transform. Nodes live in arrays indexed by id, parents always before their
+// children, so update() is one pass in id order that recomputes only nodes whose local transform was changed, or
+// whose parent's world transform was. World matrices sit contiguously in worldMatrices() for bulk upload or culling.
+class SceneGraph
+{
+public:
+    typedef unsigned int NodeId;
+    static const NodeId NO_PARENT = 0xFFFFFFFFu;
+
+    // adds a node below parent (which must exist already), drawing model unless that is null
+    NodeId add(const glm::mat4& local, Model* model = nullptr, NodeId parent = NO_PARENT)
+    {
+        NodeId id = static_cast<NodeId>(locals.size());
+        locals.push_back(local);
+        worlds.push_back(local);
+        parents.push_back(parent < id ? parent : NO_PARENT);
+        dirty.push_back(1);
+        models.push_back(model);
+        lodLevels.push_back(0);
+        return id;
+    }
+
+    // replaces a node's local transform; its world transform and those below it follow at the next update()
+    void setLocal(NodeId node, const glm::mat4& local)
+    {
+        locals[node] = local;
+        dirty[node] = 1;
+    }
+
+    // brings the world transforms of changed nodes and their descendants up to date
+    void update()
+    {
+        changed.clear();
+        for (NodeId node = 0; node < locals.size(); node++)
+        {
+            NodeId parent = parents[node];
+            // a parent updated in this pass has its flag still set, as flags are only cleared below
+            if (parent != NO_PARENT && dirty[parent])
+                dirty[node] = 1;
+            if (!dirty[node])
+                continue;
+            worlds[node] = parent == NO_PARENT ? locals[node] : worlds[parent] * locals[node];
+            changed.push_back(node);
+        }
+        for (uint8_t& flag : dirty)
+            flag = 0;
+    }
+
+    size_t size() const { return locals.size(); }
+    const glm::mat4& local(NodeId node) const { return locals[node]; }
+    const glm::mat4& world(NodeId node) const { return worlds[node]; }
+    NodeId parent(NodeId node) const { return parents[node]; }
+    Model* model(NodeId node) const { return models[node]; }
+    // level of detail of the node's model, carried from frame to frame (see Model::Draw)
+    unsigned int& lodLevel(NodeId node) { return lodLevels[node]; }
+
+    // world transforms of all nodes, indexed by id
+    const vector<glm::mat4>& worldMatrices() const { return worlds; }
+
+    // nodes whose world transform the last update() recomputed, in id order
+    const vector<NodeId>& changedLastUpdate() const { return changed; }
+    size_t updatedLastFrame() const { return changed.size(); }
+
+private:
+    vector<glm::mat4> locals;
+    vector<glm::mat4> worlds;
+    vector<NodeId> parents;
+    vector<uint8_t> dirty;
+    vector<Model*> models;
+    vector<unsigned int> lodLevels;
+    vector<NodeId> changed;
+};
+#endif
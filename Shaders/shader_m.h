@@ -4,6 +4,12 @@
 #include <glad/glad.h>
 #include <glm.hpp>
 
+#include <frame_uniforms.h>
+#include <gl_state.h>
+#include <load_profiler.h>
+#include <program_cache.h>
+#include <uniform_table.h>
+
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -13,11 +19,14 @@ class Shader
 {
 public:
     unsigned int ID;
+    Uniform<glm::mat4> modelUniform;    // the "model" matrix, resolved once at link time
     // constructor generates the shader on the fly
     // ------------------------------------------------------------------------
     Shader(const char* vertexPath, const char* fragmentPath)
     {
+        std::string program = std::string(vertexPath) + " + " + fragmentPath;
         // 1. retrieve the vertex/fragment source code from filePath
+        LoadScope readScope(program, "read");
         std::string vertexCode;
         std::string fragmentCode;
         std::ifstream vShaderFile;
@@ -45,9 +54,26 @@ public:
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << e.what() << std::endl;
         }
+        readScope.bytesRead = vertexCode.size() + fragmentCode.size();
+        readScope.end();
+        // a binary stored by an earlier run with the same sources and driver makes compiling unnecessary
+        uint64_t binaryKey = ProgramCache::Key({ vertexCode, fragmentCode });
+        LoadScope cacheScope(program, "cache");
+        ID = glCreateProgram();
+        bool cached = ProgramCache::Load(binaryKey, ID);
+        cacheScope.end();
+        if (cached)
+        {
+            uniforms.reflect(ID);
+            modelUniform = uniform<glm::mat4>(MODEL_UNIFORM);
+            BindFrameUniforms(ID);
+            return;
+        }
+        glDeleteProgram(ID);
         const char* vShaderCode = vertexCode.c_str();
         const char* fShaderCode = fragmentCode.c_str();
         // 2. compile shaders
+        LoadScope compileScope(program, "compile");
         unsigned int vertex, fragment;
         // vertex shader
         vertex = glCreateShader(GL_VERTEX_SHADER);
@@ -59,8 +85,11 @@ public:
         glShaderSource(fragment, 1, &fShaderCode, NULL);
         glCompileShader(fragment);
         checkCompileErrors(fragment, "FRAGMENT");
+        compileScope.end();
         // shader Program
+        LoadScope linkScope(program, "link");
         ID = glCreateProgram();
+        ProgramCache::PrepareForStore(ID);
         glAttachShader(ID, vertex);
         glAttachShader(ID, fragment);
         glLinkProgram(ID);
@@ -68,74 +97,93 @@ public:
         // delete the shaders as they're linked into our program now and no longer necessery
         glDeleteShader(vertex);
         glDeleteShader(fragment);
+        linkScope.end();
+        LoadScope storeScope(program, "store");
+        ProgramCache::Store(binaryKey, ID);
+        uniforms.reflect(ID);
+        modelUniform = uniform<glm::mat4>(MODEL_UNIFORM);
+        BindFrameUniforms(ID);
 
     }
     // activate the shader
     // ------------------------------------------------------------------------
     void use() const
     {
-        glUseProgram(ID);
+        GLState::Instance().useProgram(ID);
+    }
+    // resolved location of an active uniform, or -1; looked up in the table reflected at link time
+    GLint location(UniformName name) const
+    {
+        return uniforms.location(name);
+    }
+    // typed handle for a uniform, to be resolved once and set every frame without any lookup
+    template <typename T>
+    Uniform<T> uniform(UniformName name) const
+    {
+        return Uniform<T>{ uniforms.location(name) };
     }
     // utility uniform functions
     // ------------------------------------------------------------------------
-    void setBool(const std::string& name, bool value) const
+    void setBool(UniformName name, bool value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+        glUniform1i(uniforms.location(name), (int)value);
     }
     // ------------------------------------------------------------------------
-    void setInt(const std::string& name, int value) const
+    void setInt(UniformName name, int value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+        glUniform1i(uniforms.location(name), value);
     }
     // ------------------------------------------------------------------------
-    void setFloat(const std::string& name, float value) const
+    void setFloat(UniformName name, float value) const
     {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+        glUniform1f(uniforms.location(name), value);
     }
     // ------------------------------------------------------------------------
-    void setVec2(const std::string& name, const glm::vec2& value) const
+    void setVec2(UniformName name, const glm::vec2& value) const
     {
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform2fv(uniforms.location(name), 1, &value[0]);
     }
-    void setVec2(const std::string& name, float x, float y) const
+    void setVec2(UniformName name, float x, float y) const
     {
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+        glUniform2f(uniforms.location(name), x, y);
     }
     // ------------------------------------------------------------------------
-    void setVec3(const std::string& name, const glm::vec3& value) const
+    void setVec3(UniformName name, const glm::vec3& value) const
     {
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform3fv(uniforms.location(name), 1, &value[0]);
     }
-    void setVec3(const std::string& name, float x, float y, float z) const
+    void setVec3(UniformName name, float x, float y, float z) const
     {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+        glUniform3f(uniforms.location(name), x, y, z);
     }
     // ------------------------------------------------------------------------
-    void setVec4(const std::string& name, const glm::vec4& value) const
+    void setVec4(UniformName name, const glm::vec4& value) const
     {
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform4fv(uniforms.location(name), 1, &value[0]);
     }
-    void setVec4(const std::string& name, float x, float y, float z, float w) const
+    void setVec4(UniformName name, float x, float y, float z, float w) const
     {
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+        glUniform4f(uniforms.location(name), x, y, z, w);
     }
     // ------------------------------------------------------------------------
-    void setMat2(const std::string& name, const glm::mat2& mat) const
+    void setMat2(UniformName name, const glm::mat2& mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix2fv(uniforms.location(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
-    void setMat3(const std::string& name, const glm::mat3& mat) const
+    void setMat3(UniformName name, const glm::mat3& mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(uniforms.location(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
-    void setMat4(const std::string& name, const glm::mat4& mat) const
+    void setMat4(UniformName name, const glm::mat4& mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix4fv(uniforms.location(name), 1, GL_FALSE, &mat[0][0]);
     }
 
 private:
+    UniformTable uniforms;
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type)
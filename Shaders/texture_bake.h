@@ -0,0 +1,362 @@
+#ifndef TEXTURE_BAKE_H
+#define TEXTURE_BAKE_H
+
+#include <glm.hpp>
+#include <stb_image.h>
+
+#include <ktx.h>
+#include <obj_reader.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Offline texture baking: decodes every texture referenced by the models in a directory, builds its mip chain
+// with a gamma-correct separable filter and block-compresses each level into a KTX container next to the
+// source. Colour maps become BC1 (or BC3 when they carry alpha); bump maps (map_bump, sampled as texture_normal)
+// hold heights rather than vectors and become single-channel BC4 from their red channel, filtered linearly.
+// Run with `--bake-textures [directory]`; DecodeImage then prefers the baked file at runtime.
+
+// one mip level in linear float RGBA
+struct BakeLevel {
+    int width = 0;
+    int height = 0;
+    vector<glm::vec4> texels;
+
+    const glm::vec4& at(int x, int y) const
+    {
+        // wrap, since the park textures are sampled with GL_REPEAT
+        x = ((x % width) + width) % width;
+        y = ((y % height) + height) % height;
+        return texels[size_t(y) * width + x];
+    }
+};
+
+inline float SrgbToLinear(float c)
+{
+    return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+inline float LinearToSrgb(float c)
+{
+    return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+}
+
+// halves a level with a separable [1 3 3 1]/8 kernel, which unlike a 2x2 box doesn't alias on odd detail
+inline BakeLevel DownsampleLevel(const BakeLevel& source)
+{
+    static const float weights[4] = { 1.0f / 8.0f, 3.0f / 8.0f, 3.0f / 8.0f, 1.0f / 8.0f };
+    BakeLevel horizontal;
+    horizontal.width = std::max(1, source.width / 2);
+    horizontal.height = source.height;
+    horizontal.texels.resize(size_t(horizontal.width) * horizontal.height);
+    for (int y = 0; y < horizontal.height; y++)
+        for (int x = 0; x < horizontal.width; x++)
+        {
+            glm::vec4 sum(0.0f);
+            for (int t = 0; t < 4; t++)
+                sum += source.at(2 * x - 1 + t, y) * weights[t];
+            horizontal.texels[size_t(y) * horizontal.width + x] = source.width == 1 ? source.at(x, y) : sum;
+        }
+
+    BakeLevel result;
+    result.width = horizontal.width;
+    result.height = std::max(1, source.height / 2);
+    result.texels.resize(size_t(result.width) * result.height);
+    for (int y = 0; y < result.height; y++)
+        for (int x = 0; x < result.width; x++)
+        {
+            glm::vec4 sum(0.0f);
+            for (int t = 0; t < 4; t++)
+                sum += horizontal.at(x, 2 * y - 1 + t) * weights[t];
+            result.texels[size_t(y) * result.width + x] = source.height == 1 ? horizontal.at(x, y) : sum;
+        }
+    return result;
+}
+
+// reads the 4x4 block at (bx, by) as 8-bit RGBA, clamping at the image edge; colour channels are re-encoded
+// as sRGB when srgb is set
+inline void FetchBlock(const BakeLevel& level, int bx, int by, bool srgb, unsigned char block[16][4])
+{
+    for (int i = 0; i < 16; i++)
+    {
+        int x = std::min(bx * 4 + i % 4, level.width - 1);
+        int y = std::min(by * 4 + i / 4, level.height - 1);
+        const glm::vec4& texel = level.texels[size_t(y) * level.width + x];
+        for (int c = 0; c < 4; c++)
+        {
+            float value = texel[c];
+            if (c < 3 && srgb)
+                value = LinearToSrgb(value);
+            block[i][c] = static_cast<unsigned char>(glm::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+        }
+    }
+}
+
+inline uint16_t PackRgb565(const glm::vec3& color)
+{
+    int r = static_cast<int>(glm::clamp(color.x, 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+    int g = static_cast<int>(glm::clamp(color.y, 0.0f, 255.0f) * 63.0f / 255.0f + 0.5f);
+    int b = static_cast<int>(glm::clamp(color.z, 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+    return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+inline glm::vec3 UnpackRgb565(uint16_t packed)
+{
+    int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+    return glm::vec3(float((r << 3) | (r >> 2)), float((g << 2) | (g >> 4)), float((b << 3) | (b >> 2)));
+}
+
+// BC1 colour block: endpoints from the principal axis of the block's colours, inset slightly, then each
+// texel takes the nearest of the four palette entries
+inline void EncodeBC1Block(const unsigned char block[16][4], unsigned char* out)
+{
+    glm::vec3 colors[16];
+    glm::vec3 mean(0.0f);
+    for (int i = 0; i < 16; i++)
+    {
+        colors[i] = glm::vec3(block[i][0], block[i][1], block[i][2]);
+        mean += colors[i];
+    }
+    mean /= 16.0f;
+
+    // covariance and a few power iterations for the dominant direction
+    float cov[6] = { 0, 0, 0, 0, 0, 0 };
+    for (int i = 0; i < 16; i++)
+    {
+        glm::vec3 d = colors[i] - mean;
+        cov[0] += d.x * d.x; cov[1] += d.x * d.y; cov[2] += d.x * d.z;
+        cov[3] += d.y * d.y; cov[4] += d.y * d.z; cov[5] += d.z * d.z;
+    }
+    // start from the covariance row of largest magnitude; a fixed start such as (1,1,1) can be
+    // orthogonal to the answer (e.g. red rising while green falls)
+    glm::vec3 rows[3] = { glm::vec3(cov[0], cov[1], cov[2]), glm::vec3(cov[1], cov[3], cov[4]), glm::vec3(cov[2], cov[4], cov[5]) };
+    glm::vec3 axis = rows[0];
+    for (int r = 1; r < 3; r++)
+        if (glm::dot(rows[r], rows[r]) > glm::dot(axis, axis))
+            axis = rows[r];
+    float axisLength = glm::length(axis);
+    axis = axisLength > 1e-6f ? axis / axisLength : glm::vec3(0.57735f, 0.57735f, 0.57735f);
+    for (int iteration = 0; iteration < 8; iteration++)
+    {
+        glm::vec3 next(cov[0] * axis.x + cov[1] * axis.y + cov[2] * axis.z,
+                       cov[1] * axis.x + cov[3] * axis.y + cov[4] * axis.z,
+                       cov[2] * axis.x + cov[4] * axis.y + cov[5] * axis.z);
+        float length = glm::length(next);
+        if (length < 1e-6f)
+            break;
+        axis = next / length;
+    }
+
+    float lo = 1e30f, hi = -1e30f;
+    for (int i = 0; i < 16; i++)
+    {
+        float t = glm::dot(colors[i] - mean, axis);
+        lo = std::min(lo, t);
+        hi = std::max(hi, t);
+    }
+    float inset = (hi - lo) / 16.0f;
+    uint16_t c0 = PackRgb565(mean + axis * (hi - inset));
+    uint16_t c1 = PackRgb565(mean + axis * (lo + inset));
+    if (c0 < c1)
+        std::swap(c0, c1);
+
+    uint32_t indices = 0;
+    if (c0 != c1)
+    {
+        glm::vec3 palette[4];
+        palette[0] = UnpackRgb565(c0);
+        palette[1] = UnpackRgb565(c1);
+        palette[2] = (palette[0] * 2.0f + palette[1]) / 3.0f;
+        palette[3] = (palette[0] + palette[1] * 2.0f) / 3.0f;
+        for (int i = 0; i < 16; i++)
+        {
+            int best = 0;
+            float bestError = 1e30f;
+            for (int p = 0; p < 4; p++)
+            {
+                glm::vec3 d = colors[i] - palette[p];
+                float error = glm::dot(d, d);
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= uint32_t(best) << (2 * i);
+        }
+    }
+    // c0 == c1: every texel uses index 0
+
+    out[0] = c0 & 0xFF; out[1] = c0 >> 8;
+    out[2] = c1 & 0xFF; out[3] = c1 >> 8;
+    for (int b = 0; b < 4; b++)
+        out[4 + b] = (indices >> (8 * b)) & 0xFF;
+}
+
+// BC4 single-channel block (used for bump maps and for BC3 alpha), 8-value interpolation mode
+inline void EncodeBC4Block(const unsigned char block[16][4], int channel, unsigned char* out)
+{
+    int lo = 255, hi = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        lo = std::min(lo, int(block[i][channel]));
+        hi = std::max(hi, int(block[i][channel]));
+    }
+    out[0] = static_cast<unsigned char>(hi);
+    out[1] = static_cast<unsigned char>(lo);
+
+    uint64_t indices = 0;
+    if (hi != lo)
+    {
+        float palette[8];
+        palette[0] = float(hi);
+        palette[1] = float(lo);
+        for (int p = 1; p < 7; p++)
+            palette[p + 1] = ((7 - p) * hi + p * lo) / 7.0f;
+        for (int i = 0; i < 16; i++)
+        {
+            int best = 0;
+            float bestError = 1e30f;
+            for (int p = 0; p < 8; p++)
+            {
+                float error = std::fabs(block[i][channel] - palette[p]);
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= uint64_t(best) << (3 * i);
+        }
+    }
+    for (int b = 0; b < 6; b++)
+        out[2 + b] = (indices >> (8 * b)) & 0xFF;
+}
+
+// compresses one level into the container's format
+inline vector<unsigned char> CompressLevel(const BakeLevel& level, GLenum format)
+{
+    bool srgb = format != GL_COMPRESSED_RED_RGTC1;
+    int blocksX = (level.width + 3) / 4, blocksY = (level.height + 3) / 4;
+    size_t blockBytes = KtxBlockBytes(format);
+    vector<unsigned char> data(size_t(blocksX) * blocksY * blockBytes);
+    unsigned char block[16][4];
+    for (int by = 0; by < blocksY; by++)
+        for (int bx = 0; bx < blocksX; bx++)
+        {
+            unsigned char* out = &data[(size_t(by) * blocksX + bx) * blockBytes];
+            FetchBlock(level, bx, by, srgb, block);
+            if (format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT)
+            {
+                EncodeBC1Block(block, out);
+            }
+            else if (format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+            {
+                EncodeBC4Block(block, 3, out);
+                EncodeBC1Block(block, out + 8);
+            }
+            else
+            {
+                EncodeBC4Block(block, 0, out);
+            }
+        }
+    return data;
+}
+
+// bakes one image into "<imagePath>.ktx"; returns false if the image can't be read
+inline bool BakeTexture(const string& imagePath, bool bumpMap, size_t& sourceBytes, size_t& bakedBytes)
+{
+    int width, height, components;
+    unsigned char* pixels = stbi_load(imagePath.c_str(), &width, &height, &components, 4);
+    if (!pixels)
+        return false;
+
+    BakeLevel level;
+    level.width = width;
+    level.height = height;
+    level.texels.resize(size_t(width) * height);
+    bool hasAlpha = false;
+    for (size_t i = 0; i < level.texels.size(); i++)
+    {
+        const unsigned char* p = pixels + i * 4;
+        glm::vec4 texel(p[0] / 255.0f, p[1] / 255.0f, p[2] / 255.0f, p[3] / 255.0f);
+        if (!bumpMap)
+            texel = glm::vec4(SrgbToLinear(texel.x), SrgbToLinear(texel.y), SrgbToLinear(texel.z), texel.w);
+        level.texels[i] = texel;
+        hasAlpha = hasAlpha || p[3] < 255;
+    }
+    stbi_image_free(pixels);
+
+    KtxTexture texture;
+    texture.internalFormat = bumpMap ? GL_COMPRESSED_RED_RGTC1 : hasAlpha ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    texture.width = width;
+    texture.height = height;
+    for (;;)
+    {
+        texture.levels.push_back(CompressLevel(level, texture.internalFormat));
+        bakedBytes += texture.levels.back().size();
+        if (level.width == 1 && level.height == 1)
+            break;
+        level = DownsampleLevel(level);
+    }
+    sourceBytes += size_t(width) * height * components * 4 / 3;
+    return WriteKtx(KtxPath(imagePath), texture);
+}
+
+// bakes every texture referenced by the .obj files in modelDirectory; returns a process exit code
+inline int BakeTextures(const string& modelDirectory)
+{
+    // texture path -> whether every material that names it uses it as a bump map; a file that is also used as
+    // a colour map somewhere keeps its colour format, since one container serves every use of the file
+    map<string, bool> textures;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(modelDirectory, error))
+    {
+        if (entry.path().extension() != ".obj")
+            continue;
+        // only the MTL statements are needed, so the geometry isn't imported (nor cached or reported)
+        string modelPath = entry.path().generic_string();
+        vector<Texture> used;
+        if (!ObjReader::ReadTextures(modelPath, used))
+            continue;
+        string directory = modelPath.substr(0, modelPath.find_last_of('/'));
+        for (const Texture& texture : used)
+            textures.emplace(directory + '/' + texture.path, true).first->second &= texture.type == "texture_normal";
+    }
+    if (error)
+    {
+        std::cout << "ERROR::BAKE:: cannot read " << modelDirectory << ": " << error.message() << std::endl;
+        return 1;
+    }
+
+    size_t baked = 0, upToDate = 0, failed = 0, sourceBytes = 0, bakedBytes = 0;
+    for (const auto& texture : textures)
+    {
+        if (KtxIsFresh(texture.first))
+        {
+            upToDate++;
+            continue;
+        }
+        if (BakeTexture(texture.first, texture.second, sourceBytes, bakedBytes))
+        {
+            baked++;
+            std::cout << "baked " << KtxPath(texture.first) << std::endl;
+        }
+        else
+        {
+            failed++;
+            std::cout << "ERROR::BAKE:: failed to bake " << texture.first << std::endl;
+        }
+    }
+    std::cout << "BAKE:: " << baked << " baked, " << upToDate << " up to date, " << failed << " failed; "
+              << sourceBytes / 1024 << " KiB uncompressed -> " << bakedBytes / 1024 << " KiB compressed" << std::endl;
+    return failed ? 1 : 0;
+}
+#endif
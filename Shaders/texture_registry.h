@@ -0,0 +1,170 @@
+#ifndef TEXTURE_REGISTRY_H
+#define TEXTURE_REGISTRY_H
+
+#include <glad/glad.h>
+
+#include <texture_uploader.h>
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// Process-wide table of GL textures keyed by canonical absolute path, so a file shared by several models
+// (or by a model and loadTexture) is decoded and uploaded once. Every user holds a reference; the texture
+// is deleted when the last one is released.
+//
+// Decoding can be claimed from worker threads (claim) before the GL texture exists. The GL side (acquire,
+// setBytes, release) must run on the GL thread: whoever acquires first creates the texture name, and the
+// claimant fills in the pixels whenever its model is uploaded. A texture released by everyone is forgotten along
+// with its claim, so a reader that lost the claim before that may acquire a fresh name nobody is decoding for;
+// acquire reports that case, and hands the claim to the caller.
+class TextureRegistry
+{
+public:
+    static TextureRegistry& Instance()
+    {
+        static TextureRegistry registry;
+        return registry;
+    }
+
+    // absolute, normalised form of path used as the registry key (case-folded on Windows)
+    static string CanonicalPath(const string& path)
+    {
+        std::error_code error;
+        std::filesystem::path absolute = std::filesystem::absolute(path, error);
+        if (error)
+            absolute = path;
+        std::filesystem::path canonical = std::filesystem::weakly_canonical(absolute, error);
+        string key = (error ? absolute.lexically_normal() : canonical).generic_string();
+#ifdef _WIN32
+        std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+#endif
+        return key;
+    }
+
+    // any thread: returns true if the caller is the first to ask for key and should therefore decode it
+    bool claim(const string& key)
+    {
+        lock_guard<mutex> lock(tableMutex);
+        Entry& entry = entries[key];
+        if (entry.claimed)
+            return false;
+        entry.claimed = true;
+        entry.key = key;
+        return true;
+    }
+
+    // GL thread: takes a reference on key, creating its texture name if nobody has yet. unclaimed reports that the
+    // name was just made with no claim on it, i.e. nobody will fill it unless the caller does; the caller then
+    // holds the claim.
+    unsigned int acquire(const string& key, bool& unclaimed)
+    {
+        lock_guard<mutex> lock(tableMutex);
+        Entry& entry = entries[key];
+        entry.key = key;
+        unclaimed = entry.id == 0 && !entry.claimed;
+        if (entry.id == 0)
+        {
+            glGenTextures(1, &entry.id);
+            keysById[entry.id] = key;
+        }
+        entry.claimed = true;
+        entry.refs++;
+        return entry.id;
+    }
+
+    unsigned int acquire(const string& key)
+    {
+        bool unclaimed;
+        return acquire(key, unclaimed);
+    }
+
+    // GL thread: records the video memory held by a texture (all faces and mip levels)
+    void setBytes(unsigned int id, size_t bytes)
+    {
+        lock_guard<mutex> lock(tableMutex);
+        if (Entry* entry = find(id))
+            entry->gpuBytes = bytes;
+    }
+
+    // GL thread: drops one reference; the last one deletes the texture and forgets the key
+    void release(unsigned int id)
+    {
+        lock_guard<mutex> lock(tableMutex);
+        Entry* entry = find(id);
+        if (!entry || entry->refs == 0 || --entry->refs > 0)
+            return;
+        if (TextureUploader* uploader = TextureUploader::Current())
+            uploader->cancel(id);
+        glDeleteTextures(1, &entry->id);
+        string key = entry->key;
+        keysById.erase(id);
+        entries.erase(key);
+    }
+
+    size_t bytes(unsigned int id)
+    {
+        lock_guard<mutex> lock(tableMutex);
+        Entry* entry = find(id);
+        return entry ? entry->gpuBytes : 0;
+    }
+
+    size_t totalBytes()
+    {
+        lock_guard<mutex> lock(tableMutex);
+        size_t total = 0;
+        for (const auto& item : entries)
+            total += item.second.gpuBytes;
+        return total;
+    }
+
+    // prints every live texture with its size and reference count, largest first
+    void report(ostream& out)
+    {
+        lock_guard<mutex> lock(tableMutex);
+        vector<const Entry*> live;
+        size_t total = 0;
+        for (const auto& item : entries)
+            if (item.second.id != 0)
+            {
+                live.push_back(&item.second);
+                total += item.second.gpuBytes;
+            }
+        std::sort(live.begin(), live.end(), [](const Entry* a, const Entry* b) { return a->gpuBytes > b->gpuBytes; });
+        out << "TEXTURES:: " << live.size() << " resident, " << std::fixed << std::setprecision(2) << total / (1024.0 * 1024.0) << " MiB" << std::endl;
+        for (const Entry* entry : live)
+            out << "  " << std::setw(10) << std::setprecision(1) << entry->gpuBytes / 1024.0 << " KiB  refs " << std::setw(2) << entry->refs << "  " << entry->key << std::endl;
+    }
+
+private:
+    struct Entry {
+        string key;
+        unsigned int id = 0;
+        unsigned int refs = 0;
+        size_t gpuBytes = 0;
+        bool claimed = false;
+    };
+
+    mutex tableMutex;
+    unordered_map<string, Entry> entries;
+    unordered_map<unsigned int, string> keysById;
+
+    TextureRegistry() {}
+
+    Entry* find(unsigned int id)
+    {
+        auto key = keysById.find(id);
+        if (key == keysById.end())
+            return nullptr;
+        auto entry = entries.find(key->second);
+        return entry == entries.end() ? nullptr : &entry->second;
+    }
+};
+#endif
@@ -0,0 +1,300 @@
+#ifndef TEXTURE_UPLOADER_H
+#define TEXTURE_UPLOADER_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include <gl_ext.h>
+#include <load_profiler.h>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+using namespace std;
+
+// decoded pixels of a texture file, ready to be uploaded on the GL thread
+struct ImageData {
+    string path;                    // path as referenced by the material, relative to the model directory
+    string key;                     // canonical path, see TextureRegistry
+    bool claimed = true;            // false if another load is already decoding this file
+    unsigned char* pixels = nullptr;
+    int width = 0;
+    int height = 0;
+    int components = 0;
+    GLenum compressedFormat = 0;            // set instead of pixels when a baked container was found (see ktx.h)
+    vector<vector<unsigned char>> levels;   // its compressed mip chain, level 0 first
+};
+
+// pixel format matching a decoded image's component count
+inline GLenum ImageFormat(int components)
+{
+    switch (components)
+    {
+    case 1: return GL_RED;
+    case 2: return GL_RG;
+    case 4: return GL_RGBA;
+    default: return GL_RGB;
+    }
+}
+
+// Streams decoded images into textures through a ring of pixel unpack buffer slots. Each slot is filled on
+// the CPU, handed to glTexSubImage2D as a PBO offset and fenced; the slot is only written again once its
+// fence has signalled, so the copy never waits on the GPU. Images larger than a slot go up in row bands,
+// and update() stops after frameBudget bytes so a burst of streamed assets is spread over several frames.
+// The ring is mapped persistently when ARB_buffer_storage is available, and remapped per slot otherwise.
+class TextureUploader
+{
+public:
+    // the uploader that UploadImage and loadCubemap route through, or null for synchronous uploads
+    static TextureUploader*& Current()
+    {
+        static TextureUploader* current = nullptr;
+        return current;
+    }
+
+    // needs a current GL context; becomes Current() until released
+    TextureUploader(size_t slotSize = 4 << 20, unsigned int slotCount = 4, size_t frameBudget = 8 << 20)
+        : slotSize(slotSize), frameBudget(frameBudget), slots(slotCount)
+    {
+        size_t ringSize = slotSize * slotCount;
+        glGenBuffers(1, &ring);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring);
+        if (glBufferStorageExt)
+        {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorageExt(GL_PIXEL_UNPACK_BUFFER, ringSize, nullptr, flags);
+            persistent = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, ringSize, flags));
+        }
+        else
+        {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, ringSize, nullptr, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        Current() = this;
+    }
+
+    // frees any pixels that never made it to the GPU; GL objects are released by release()
+    ~TextureUploader()
+    {
+        for (Job& job : jobs)
+            stbi_image_free(job.image.pixels);
+        if (Current() == this)
+            Current() = nullptr;
+    }
+
+    TextureUploader(const TextureUploader&) = delete;
+    TextureUploader& operator=(const TextureUploader&) = delete;
+
+    // allocates the level-0 storage of texture (bound to target, or to the given cube map face) and queues
+    // the pixels. Takes ownership of image.pixels. Mipmaps are generated once the last band has arrived.
+    void queue(unsigned int texture, GLenum target, ImageData& image, bool generateMipmap)
+    {
+        GLenum format = ImageFormat(image.components);
+        glBindTexture(bindingTarget(target), texture);
+        glTexImage2D(target, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, nullptr);
+
+        Job job;
+        job.texture = texture;
+        job.target = target;
+        job.format = format;
+        job.generateMipmap = generateMipmap;
+        job.image = image;
+        jobs.push_back(job);
+        pendingBytes += imageBytes(image);
+        image.pixels = nullptr;
+    }
+
+    // call once per frame on the GL thread: recycles slots whose fences signalled and uploads up to the frame budget
+    void update()
+    {
+        retire(false);
+        pump(frameBudget);
+    }
+
+    // uploads everything still queued, waiting for slots as needed; used at load time
+    void flush()
+    {
+        while (!jobs.empty())
+        {
+            retire(true);
+            pump(~size_t(0));
+        }
+    }
+
+    // drops everything still queued for texture, e.g. because it is being deleted
+    void cancel(unsigned int texture)
+    {
+        for (auto job = jobs.begin(); job != jobs.end();)
+        {
+            if (job->texture == texture)
+            {
+                pendingBytes -= imageBytes(job->image);
+                stbi_image_free(job->image.pixels);
+                job = jobs.erase(job);
+            }
+            else
+                ++job;
+        }
+    }
+
+    // bytes queued but not yet handed to GL
+    size_t pending() const { return pendingBytes; }
+
+    // releases the ring and its fences; call while the context is still current
+    void release()
+    {
+        for (Slot& slot : slots)
+            if (slot.fence)
+            {
+                glDeleteSync(slot.fence);
+                slot.fence = 0;
+            }
+        if (ring)
+        {
+            if (persistent)
+            {
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            }
+            glDeleteBuffers(1, &ring);
+        }
+        ring = 0;
+        persistent = nullptr;
+        if (Current() == this)
+            Current() = nullptr;
+    }
+
+private:
+    struct Slot {
+        GLsync fence = 0;
+    };
+
+    struct Job {
+        unsigned int texture = 0;
+        GLenum target = GL_TEXTURE_2D;
+        GLenum format = GL_RGB;
+        bool generateMipmap = true;
+        ImageData image;
+        int rowsDone = 0;
+    };
+
+    size_t slotSize;
+    size_t frameBudget;
+    vector<Slot> slots;
+    unsigned int nextSlot = 0;
+    unsigned int ring = 0;
+    unsigned char* persistent = nullptr;
+    deque<Job> jobs;
+    size_t pendingBytes = 0;
+
+    static GLenum bindingTarget(GLenum target)
+    {
+        return (target >= GL_TEXTURE_CUBE_MAP_POSITIVE_X && target <= GL_TEXTURE_CUBE_MAP_NEGATIVE_Z) ? GL_TEXTURE_CUBE_MAP : target;
+    }
+
+    static size_t imageBytes(const ImageData& image)
+    {
+        return size_t(image.width) * image.height * image.components;
+    }
+
+    // frees slots whose copies have completed; with wait set, blocks until the next slot in the ring is free
+    void retire(bool wait)
+    {
+        for (Slot& slot : slots)
+        {
+            if (slot.fence && glClientWaitSync(slot.fence, 0, 0) != GL_TIMEOUT_EXPIRED)
+            {
+                glDeleteSync(slot.fence);
+                slot.fence = 0;
+            }
+        }
+        // slots are filled in ring order, so the next one is always the oldest
+        Slot& next = slots[nextSlot];
+        if (wait && next.fence)
+        {
+            glClientWaitSync(next.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+            glDeleteSync(next.fence);
+            next.fence = 0;
+        }
+    }
+
+    // uploads row bands into free slots until budget bytes have been sent or the ring is full
+    void pump(size_t budget)
+    {
+        size_t sent = 0;
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // bands are tightly packed rows
+        while (!jobs.empty() && sent < budget)
+        {
+            Job& job = jobs.front();
+            size_t rowBytes = size_t(job.image.width) * job.image.components;
+            glBindTexture(bindingTarget(job.target), job.texture);
+
+            if (rowBytes > slotSize || !job.image.pixels)
+            {
+                // a single row doesn't fit a slot: fall back to a direct upload of the whole image
+                LoadScope scope(job.image.key.empty() ? job.image.path : job.image.key, "upload");
+                if (job.image.pixels)
+                {
+                    glTexSubImage2D(job.target, 0, 0, 0, job.image.width, job.image.height, job.format, GL_UNSIGNED_BYTE, job.image.pixels);
+                    scope.textureBytes = imageBytes(job.image);
+                }
+                scope.end();
+                sent += imageBytes(job.image);
+                finish(job);
+                continue;
+            }
+
+            Slot& slot = slots[nextSlot];
+            if (slot.fence)
+                break; // ring is full; pick up again next frame (or after retire(true) when flushing)
+            LoadScope scope(job.image.key.empty() ? job.image.path : job.image.key, "upload");
+
+            int rows = static_cast<int>(std::min<size_t>(job.image.height - job.rowsDone, slotSize / rowBytes));
+            size_t bytes = rows * rowBytes;
+            size_t offset = nextSlot * slotSize;
+            const unsigned char* source = job.image.pixels + job.rowsDone * rowBytes;
+
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring);
+            if (persistent)
+            {
+                memcpy(persistent + offset, source, bytes);
+            }
+            else
+            {
+                // the fence guarantees the GPU is done with this slot, so no implicit synchronisation is needed
+                void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, offset, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+                memcpy(mapped, source, bytes);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            }
+            glTexSubImage2D(job.target, 0, 0, job.rowsDone, job.image.width, rows, job.format, GL_UNSIGNED_BYTE, reinterpret_cast<void*>(offset));
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            nextSlot = (nextSlot + 1) % slots.size();
+            scope.textureBytes = bytes;
+            scope.end();
+
+            job.rowsDone += rows;
+            sent += bytes;
+            if (job.rowsDone >= job.image.height)
+                finish(job);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+
+    // completes the front job: builds its mip chain and releases the pixels
+    void finish(Job& job)
+    {
+        if (job.generateMipmap && job.image.pixels)
+        {
+            LoadScope scope(job.image.key.empty() ? job.image.path : job.image.key, "mipmap");
+            glGenerateMipmap(bindingTarget(job.target));
+        }
+        pendingBytes -= imageBytes(job.image);
+        stbi_image_free(job.image.pixels);
+        jobs.pop_front();
+    }
+};
+#endif
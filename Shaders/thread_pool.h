@@ -0,0 +1,127 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads draining a FIFO of jobs. Jobs must not block on other jobs of the same pool.
+class ThreadPool
+{
+public:
+    // threadCount 0 picks one worker per hardware thread, minus the one the caller (usually the GL thread) runs on
+    explicit ThreadPool(unsigned int threadCount = 0)
+    {
+        if (threadCount == 0)
+            threadCount = std::max(2u, std::thread::hardware_concurrency()) - 1;
+        for (unsigned int i = 0; i < threadCount; i++)
+            workers.emplace_back([this] { workerLoop(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(job));
+        }
+        wake.notify_one();
+    }
+
+    unsigned int size() const { return static_cast<unsigned int>(workers.size()); }
+
+    // runs body(i) for every i in [0, count) on the workers and the calling thread, and returns once all are
+    // done. Workers that only get to it afterwards find nothing left and return at once, so the caller never
+    // waits for a worker busy with something else; this also makes it safe to call from a job of this pool,
+    // where it runs on whichever workers are idle (or the job's own thread alone when none is).
+    void parallelFor(size_t count, const std::function<void(size_t)>& body)
+    {
+        struct Batch {
+            std::atomic<size_t> next{ 0 };
+            std::atomic<size_t> done{ 0 };
+            size_t count = 0;
+            const std::function<void(size_t)>* body = nullptr;
+            std::mutex mutex;
+            std::condition_variable finished;
+        };
+        if (count == 0)
+            return;
+        std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+        batch->count = count;
+        batch->body = &body;
+        auto run = [batch]
+        {
+            for (size_t i = batch->next++; i < batch->count; i = batch->next++)
+            {
+                (*batch->body)(i);
+                if (++batch->done == batch->count)
+                {
+                    std::lock_guard<std::mutex> lock(batch->mutex);
+                    batch->finished.notify_all();
+                }
+            }
+        };
+        size_t helpers = std::min<size_t>(count - 1, workers.size());
+        for (size_t h = 0; h < helpers; h++)
+            submit(run);
+        run();
+        std::unique_lock<std::mutex> lock(batch->mutex);
+        batch->finished.wait(lock, [&] { return batch->done == batch->count; });
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void workerLoop()
+    {
+        for (;;)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (stopping && jobs.empty())
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+};
+
+// runs body(i) for every i in [0, count) through pool->parallelFor, or in order on the calling thread without a pool
+inline void ParallelFor(ThreadPool* pool, size_t count, const std::function<void(size_t)>& body)
+{
+    if (pool)
+    {
+        pool->parallelFor(count, body);
+        return;
+    }
+    for (size_t i = 0; i < count; i++)
+        body(i);
+}
+#endif
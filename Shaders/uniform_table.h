@@ -0,0 +1,118 @@
+#ifndef UNIFORM_TABLE_H
+#define UNIFORM_TABLE_H
+
+#include <glad/glad.h>
+#include <glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// FNV-1a of a uniform name; constexpr so names written in the source can be hashed by the compiler
+constexpr uint32_t UniformHash(const char* name, uint32_t hash = 2166136261u)
+{
+    return *name ? UniformHash(name + 1, (hash ^ static_cast<uint8_t>(*name)) * 16777619u) : hash;
+}
+
+// a uniform name reduced to its hash, which is all a UniformTable lookup compares. The constructor only runs at
+// compile time where a constant is required, so names looked up often are declared as constexpr constants below.
+struct UniformName {
+    uint32_t hash;
+    constexpr UniformName(const char* name) : hash(UniformHash(name)) {}
+    UniformName(const std::string& name) : hash(UniformHash(name.c_str())) {}
+};
+
+// the placement matrix every model shader takes (see Shader::modelUniform)
+constexpr UniformName MODEL_UNIFORM("model");
+
+// glUniform* for each GLSL type a Uniform can hold; they write to the program in use
+inline void SetUniform(GLint location, bool value) { glUniform1i(location, (int)value); }
+inline void SetUniform(GLint location, int value) { glUniform1i(location, value); }
+inline void SetUniform(GLint location, float value) { glUniform1f(location, value); }
+inline void SetUniform(GLint location, const glm::vec2& value) { glUniform2fv(location, 1, &value[0]); }
+inline void SetUniform(GLint location, const glm::vec3& value) { glUniform3fv(location, 1, &value[0]); }
+inline void SetUniform(GLint location, const glm::vec4& value) { glUniform4fv(location, 1, &value[0]); }
+inline void SetUniform(GLint location, const glm::mat2& value) { glUniformMatrix2fv(location, 1, GL_FALSE, &value[0][0]); }
+inline void SetUniform(GLint location, const glm::mat3& value) { glUniformMatrix3fv(location, 1, GL_FALSE, &value[0][0]); }
+inline void SetUniform(GLint location, const glm::mat4& value) { glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]); }
+
+// a resolved uniform location with its type fixed at compile time, see Shader::uniform. Setting it is a single
+// glUniform call on the program in use; an inactive uniform has location -1, which GL ignores.
+template <typename T>
+struct Uniform {
+    GLint location = -1;
+
+    void set(const T& value) const
+    {
+        SetUniform(location, value);
+    }
+
+    bool valid() const { return location >= 0; }
+};
+
+// The active uniforms of a linked program, reflected once with glGetActiveUniform and kept sorted by name hash.
+// Every element of a uniform array is listed under its own "name[i]"; the first one also as plain "name".
+class UniformTable
+{
+public:
+    void reflect(GLuint program)
+    {
+        entries.clear();
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<GLchar> buffer(std::max(maxLength, 1) + 16);
+        for (GLint i = 0; i < count; i++)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(program, i, static_cast<GLsizei>(buffer.size()), &length, &size, &type, buffer.data());
+            std::string name(buffer.data(), length);
+            // arrays of basic types are reported as "name[0]"; members of struct arrays come one by one, e.g. "lights[1].color"
+            bool array = name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0;
+            std::string base = array ? name.substr(0, name.size() - 3) : name;
+            GLint location = glGetUniformLocation(program, name.c_str());
+            if (location < 0)
+                continue; // a uniform block member; those are set through their buffer
+            add(base, location);
+            if (array)
+                for (GLint element = 0; element < size; element++)
+                {
+                    std::string elementName = base + '[' + std::to_string(element) + ']';
+                    add(elementName, element == 0 ? location : glGetUniformLocation(program, elementName.c_str()));
+                }
+        }
+        std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.hash < b.hash; });
+        for (size_t i = 1; i < entries.size(); i++)
+            if (entries[i].hash == entries[i - 1].hash && entries[i].name != entries[i - 1].name)
+                std::cout << "ERROR::SHADER::UNIFORM_HASH_COLLISION: " << entries[i - 1].name << " and " << entries[i].name << std::endl;
+    }
+
+    // location of an active uniform, -1 if the program has none by that name
+    GLint location(UniformName name) const
+    {
+        auto found = std::lower_bound(entries.begin(), entries.end(), name.hash, [](const Entry& entry, uint32_t hash) { return entry.hash < hash; });
+        return found != entries.end() && found->hash == name.hash ? found->location : -1;
+    }
+
+    size_t size() const { return entries.size(); }
+
+private:
+    struct Entry {
+        uint32_t hash;
+        GLint location;
+        std::string name;   // only for reporting collisions
+    };
+
+    std::vector<Entry> entries;
+
+    void add(const std::string& name, GLint location)
+    {
+        entries.push_back(Entry{ UniformHash(name.c_str()), location, name });
+    }
+};
+#endif
@@ -9,7 +9,21 @@
 #include <shader_m.h>
 #include <camera.h>
 #include <model.h>
-
+#include <asset_loader.h>
+#include <model_streamer.h>
+#include <render_queue.h>
+#include <frame_builder.h>
+#include <frame_uniforms.h>
+#include <scene_graph.h>
+#include <bvh.h>
+#include <bvh_benchmark.h>
+#include <occlusion_culler.h>
+#include <thread_pool.h>
+#include <texture_uploader.h>
+#include <texture_bake.h>
+
+#include <cctype>
+#include <cstdlib>
 #include <iostream>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
@@ -18,6 +32,8 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow* window);
 unsigned int loadTexture(const char* path);
 unsigned int loadCubemap(vector<std::string> faces);
+glm::mat4 placement(const glm::vec3& position, const glm::vec3& scale, float angle = 0.0f, const glm::vec3& axis = glm::vec3(0.0f, 1.0f, 0.0f));
+Bounds placedBounds(const SceneGraph& scene, const ModelStreamer& streamer, SceneGraph::NodeId node);
 
 // settings
 const unsigned int SCR_WIDTH = 1500;
@@ -33,8 +49,29 @@ bool firstMouse = true;
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
-int main()
+int main(int argc, char** argv)
 {
+    // offline mode: bake the park's textures into compressed containers and exit, no window needed
+    // -------------------------------------------------------------------------------------------
+    if (argc > 1 && std::string(argv[1]) == "--bake-textures")
+        return BakeTextures(argc > 2 ? argv[2] : "resources/objects/themepark");
+    // offline mode: time the placement BVH against linear culling and ray casts
+    if (argc > 1 && std::string(argv[1]) == "--bench-bvh")
+    {
+        size_t placements = 10000;
+        if (argc > 2)
+        {
+            char* end = nullptr;
+            placements = std::isdigit(static_cast<unsigned char>(argv[2][0])) ? std::strtoul(argv[2], &end, 10) : 0;
+            if (!end || *end != '\0' || placements == 0)
+            {
+                std::cout << "ERROR::BVH:: placement count must be a positive number, got " << argv[2] << std::endl;
+                return 1;
+            }
+        }
+        return BenchmarkBVH(placements);
+    }
+
     // glfw: initialize and configure
     // ------------------------------
     glfwInit();
@@ -70,6 +107,7 @@ int main()
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    LoadGLExtensions((GLADloadproc)glfwGetProcAddress);
 
     // configure global opengl state
     // -----------------------------
@@ -79,74 +117,113 @@ int main()
     // -------------------------
     Shader shader("src/6.1.cubemaps.vs", "src/6.1.cubemaps.fs");
     Shader skyboxShader("src/6.1.skybox.vs", "src/6.1.skybox.fs");
+    // draws repeated placements of a model with one call, see RenderQueue::instanceWith
+    Shader instancedShader("src/10.2.instancing.vs", "src/10.2.instancing.fs");
 
     // load models
+    // -----------
+    // meshes are parsed and textures decoded on worker threads; only the GL upload runs on this thread,
+    // inside waitRequired() and pump(). The far-away palace and bench are streamed in once the camera gets
+    // close: loaded a little before they can cross the far plane, unloaded when well beyond it.
+    TextureUploader uploader;
+    AssetLoader loader;
+    ModelStreamer streamer(loader, 1100.0f, 1300.0f);
 
-  
-    Model circus("resources/objects/themepark/AnyConv.com__circus.obj");
+    // the biggest models hide what stands behind them (see OcclusionCuller)
+    Model circus;
+    circus.keepOccluder = true;
+    loader.load(circus, "resources/objects/themepark/AnyConv.com__circus.obj");
 
-    Model ferris_wheel("resources/objects/themepark/AnyConv.com__ferris_wheel_low_poly.obj");
+    Model ferris_wheel;
+    loader.load(ferris_wheel, "resources/objects/themepark/AnyConv.com__ferris_wheel_low_poly.obj");
 
-    Model food_cart("resources/objects/themepark/AnyConv.com__avika_street_food_cart.obj");
+    Model food_cart;
+    loader.load(food_cart, "resources/objects/themepark/AnyConv.com__avika_street_food_cart.obj");
 
-    Model sport("resources/objects/themepark/AnyConv.com__zis-101a_sport_1938.obj");
+    Model sport;
+    loader.load(sport, "resources/objects/themepark/AnyConv.com__zis-101a_sport_1938.obj");
 
-    Model hot_air_baloon("resources/objects/themepark/AnyConv.com__hot_air_balloon_-_low_poly.obj");
+    Model hot_air_baloon;
+    loader.load(hot_air_baloon, "resources/objects/themepark/AnyConv.com__hot_air_balloon_-_low_poly.obj");
 
-    Model seasaw("resources/objects/themepark/AnyConv.com__seesaw.obj");
+    Model seasaw;
+    loader.load(seasaw, "resources/objects/themepark/AnyConv.com__seesaw.obj");
 
-    Model swing("resources/objects/themepark/AnyConv.com__swing.obj");
+    Model swing;
+    loader.load(swing, "resources/objects/themepark/AnyConv.com__swing.obj");
 
-    Model swing2("resources/objects/themepark/AnyConv.com__swing_gameasset_under_18k_triangles_with_uv.obj");
+    Model swing2;
+    loader.load(swing2, "resources/objects/themepark/AnyConv.com__swing_gameasset_under_18k_triangles_with_uv.obj");
 
-    Model micky("resources/objects/themepark/AnyConv.com__tahla_mickey_mouse.obj");
+    Model micky;
+    loader.load(micky, "resources/objects/themepark/AnyConv.com__tahla_mickey_mouse.obj");
 
-    Model carosel("resources/objects/themepark/AnyConv.com__spaceship_carousel_-_discovery.obj");
+    Model carosel;
+    loader.load(carosel, "resources/objects/themepark/AnyConv.com__spaceship_carousel_-_discovery.obj");
 
-    Model carosel2("resources/objects/themepark/AnyConv.com__sports_town-carouselhelix..obj");
+    Model carosel2;
+    loader.load(carosel2, "resources/objects/themepark/AnyConv.com__sports_town-carouselhelix..obj");
 
-    Model copter("resources/objects/plan/brabazon.obj");
+    Model copter;
+    loader.load(copter, "resources/objects/plan/brabazon.obj");
 
-    Model bike("resources/objects/town/AnyConv.com__speedboat_n2.obj");
+    Model bike;
+    loader.load(bike, "resources/objects/town/AnyConv.com__speedboat_n2.obj");
 
-    Model roller_coaster("resources/objects/themepark/AnyConv.com__15_the_fall_3december2019.obj");
+    Model roller_coaster;
+    loader.load(roller_coaster, "resources/objects/themepark/AnyConv.com__15_the_fall_3december2019.obj");
 
-    Model ship_food_cart("resources/objects/themepark/AnyConv.com__airship_restaurant_-_lunapark.obj");
+    Model ship_food_cart;
+    loader.load(ship_food_cart, "resources/objects/themepark/AnyConv.com__airship_restaurant_-_lunapark.obj");
 
-    Model gate("resources/objects/themepark/AnyConv.com__ishtar_gate_babylon.obj");
+    Model gate;
+    loader.load(gate, "resources/objects/themepark/AnyConv.com__ishtar_gate_babylon.obj");
 
-    Model seesaw("resources/objects/themepark/AnyConv.com__seesaw_type-1.obj");
+    Model seesaw;
+    loader.load(seesaw, "resources/objects/themepark/AnyConv.com__seesaw_type-1.obj");
 
-    Model carousel3("resources/objects/themepark/AnyConv.com__christmas_carousel.obj");
+    Model carousel3;
+    loader.load(carousel3, "resources/objects/themepark/AnyConv.com__christmas_carousel.obj");
 
-    Model water("resources/objects/themepark/AnyConv.com__playground.obj");
+    Model water;
+    loader.load(water, "resources/objects/themepark/AnyConv.com__playground.obj");
 
-    Model palace("resources/objects/themepark/AnyConv.com__cologne_cathedral.obj");
+    Model palace;
+    palace.keepOccluder = true;
+    streamer.add(palace, "resources/objects/themepark/AnyConv.com__cologne_cathedral.obj");
 
-    Model tire("resources/objects/themepark/AnyConv.com__inflatable_pool_float.obj");
+    Model tire;
+    loader.load(tire, "resources/objects/themepark/AnyConv.com__inflatable_pool_float.obj");
 
-    Model ballon("resources/objects/themepark/AnyConv.com__cartoon_balloons.obj");
+    Model ballon;
+    loader.load(ballon, "resources/objects/themepark/AnyConv.com__cartoon_balloons.obj");
 
-    Model welcome("resources/objects/themepark/AnyConv.com__welcome3D.obj");
+    Model welcome;
+    loader.load(welcome, "resources/objects/themepark/AnyConv.com__welcome3D.obj");
 
-    Model helicopter("resources/objects/themepark/AnyConv.com__helicopter.obj");
+    Model helicopter;
+    loader.load(helicopter, "resources/objects/themepark/AnyConv.com__helicopter.obj");
 
-    Model slide("resources/objects/themepark/AnyConv.com__slide_playground.obj");
+    Model slide;
+    loader.load(slide, "resources/objects/themepark/AnyConv.com__slide_playground.obj");
     
-    Model chalkboard("resources/objects/themepark/AnyConv.com__chalkboard_sign_v2.obj");
+    Model chalkboard;
+    loader.load(chalkboard, "resources/objects/themepark/AnyConv.com__chalkboard_sign_v2.obj");
    
-    Model elephant("resources/objects/themepark/AnyConv.com__circus_elephant.obj");
+    Model elephant;
+    loader.load(elephant, "resources/objects/themepark/AnyConv.com__circus_elephant.obj");
 
-    Model claw("resources/objects/themepark/AnyConv.com__claw_machine.obj");
+    Model claw;
+    loader.load(claw, "resources/objects/themepark/AnyConv.com__claw_machine.obj");
 
-    Model fountain("resources/objects/themepark/AnyConv.com__fountain.obj");
+    Model fountain;
+    loader.load(fountain, "resources/objects/themepark/AnyConv.com__fountain.obj");
 
-    Model bench("resources/objects/themepark/bench.obj");
+    Model bench;
+    streamer.add(bench, "resources/objects/themepark/bench.obj");
 
+    loader.waitRequired();
 
-    
-
-    
 
     // set up vertex data (and buffer(s)) and configure vertex attributes
     // ------------------------------------------------------------------
@@ -237,6 +314,86 @@ int main()
     skyboxShader.use();
     skyboxShader.setInt("skybox", 0);
 
+    // everything loaded so far should be on screen in the first frame; later textures stream in through update()
+    uploader.flush();
+    TextureRegistry::Instance().report(std::cout);
+
+    // camera matrices, time and viewport for every shader, written once per frame
+    FrameUniforms frameUniforms;
+    frameUniforms.create();
+
+    // the park's draws are collected here each frame and issued sorted by state
+    RenderQueue renderQueue;
+    renderQueue.instanceWith(shader, instancedShader);
+
+    // the park's placements; each node keeps its model's level of detail, so a model placed twice has two
+    SceneGraph scene;
+    float rotAngle = 45;
+    scene.add(placement(glm::vec3(-90.0f, -30.0f, -480.0f), glm::vec3(8.0f)), &circus);
+    scene.add(placement(glm::vec3(-100.0f, -30.0f, -100.0f), glm::vec3(8.0f), rotAngle, glm::vec3(0.0f, 0.25f, 0.0f)), &ferris_wheel);
+    scene.add(placement(glm::vec3(140.0f, -10.0f, -200.0f), glm::vec3(12.0f)), &food_cart);
+    scene.add(placement(glm::vec3(75.0f, -10.0f, -200.0f), glm::vec3(12.0f)), &seesaw);
+    scene.add(placement(glm::vec3(-100.0f, 20.0f, 300.0f), glm::vec3(8.0f)), &ship_food_cart);
+    // micky circles a pivot: pivot -> orbit (rotated every frame) -> micky, 300 units out
+    SceneGraph::NodeId mickyPivot = scene.add(placement(glm::vec3(-25.0f, -10.0f, 0.0f), glm::vec3(0.5f)));
+    SceneGraph::NodeId mickyOrbit = scene.add(glm::mat4(1.0f), nullptr, mickyPivot);
+    scene.add(placement(glm::vec3(300.0f, 0.0f, 0.0f), glm::vec3(1.0f), rotAngle, glm::vec3(0.4f, 0.6f, 0.8f)), &micky, mickyOrbit);
+    scene.add(placement(glm::vec3(-300.0f, -10.0f, -380.0f), glm::vec3(5.0f, 5.0f, 10.0f), rotAngle, glm::vec3(0.0f, 0.15f, 0.0f)), &roller_coaster);
+    scene.add(placement(glm::vec3(200.0f, -10.0f, -100.0f), glm::vec3(0.07f), rotAngle, glm::vec3(0.0f, 0.40f, 0.0f)), &swing);
+    scene.add(placement(glm::vec3(200.0f, -10.0f, -0.300f), glm::vec3(6.0f)), &slide);
+    scene.add(placement(glm::vec3(40.0f, -10.0f, -200.0f), glm::vec3(70.0f)), &sport);
+    scene.add(placement(glm::vec3(40.0f, 30.0f, 0.0f), glm::vec3(0.70f), rotAngle, glm::vec3(0.0f, -0.15f, 0.0f)), &hot_air_baloon);
+    scene.add(placement(glm::vec3(305.0f, -10.0f, -100.0f), glm::vec3(20.0f)), &carosel);
+    scene.add(placement(glm::vec3(55.0f, -10.0f, -200.0f), glm::vec3(6.0f)), &carosel2);
+    scene.add(placement(glm::vec3(-45.0f, -20.0f, 90.0f), glm::vec3(3.0f)), &bike);
+    scene.add(placement(glm::vec3(340.0f, 40.0f, 45.0f), glm::vec3(0.70f), rotAngle, glm::vec3(0.0f, -0.15f, 0.0f)), &hot_air_baloon);
+    scene.add(placement(glm::vec3(0.0f, -20.0f, 90.0f), glm::vec3(3.0f)), &bike);
+    scene.add(placement(glm::vec3(20.0f, -10.0f, -160.0f), glm::vec3(6.0f)), &claw);
+    // the helicopter circles like micky
+    SceneGraph::NodeId helicopterPivot = scene.add(placement(glm::vec3(0.0f, 40.0f, 90.0f), glm::vec3(0.01f)));
+    SceneGraph::NodeId helicopterOrbit = scene.add(glm::mat4(1.0f), nullptr, helicopterPivot);
+    scene.add(placement(glm::vec3(300.0f, 0.0f, 0.0f), glm::vec3(1.0f), rotAngle, glm::vec3(0.0f, 0.8f, 0.0f)), &helicopter, helicopterOrbit);
+    scene.add(placement(glm::vec3(85.0f, -10.0f, 20.0f), glm::vec3(3.0f)), &carousel3);
+    scene.add(placement(glm::vec3(50.0f, -20.0f, 170.0f), glm::vec3(12.0f)), &water);
+    scene.add(placement(glm::vec3(-400.0f, -20.0f, 1850.0f), glm::vec3(150.0f)), &palace);
+    scene.add(placement(glm::vec3(-40.0f, -20.0f, 360.0f), glm::vec3(0.05f), rotAngle, glm::vec3(0.0f, -0.15f, 0.0f)), &tire);
+    scene.add(placement(glm::vec3(40.0f, -10.0f, -50.0f), glm::vec3(3.0f)), &fountain);
+    scene.add(placement(glm::vec3(1850.0f, -10.0f, -10.0f), glm::vec3(5.0f, 5.0f, 10.0f), rotAngle, glm::vec3(0.0f, 0.15f, 0.0f)), &bench);
+    scene.add(placement(glm::vec3(-400.0f, -20.0f, 1050.0f), glm::vec3(150.0f)), &palace);
+    scene.update();
+
+    // the placements that draw a model, as items of a BVH over their world boxes so the frame only visits those
+    // in view; streamed ones are also listed on their own, since the streamer needs to see them all
+    vector<SceneGraph::NodeId> placedNodes, streamedNodes;
+    vector<BVH::ItemId> nodeItems(scene.size(), BVH::NO_ITEM);
+    vector<Bounds> itemBounds;
+    for (SceneGraph::NodeId node = 0; node < scene.size(); node++)
+        if (Model* placed = scene.model(node))
+        {
+            nodeItems[node] = static_cast<BVH::ItemId>(placedNodes.size());
+            placedNodes.push_back(node);
+            itemBounds.push_back(placedBounds(scene, streamer, node));
+            if (streamer.streams(*placed))
+                streamedNodes.push_back(node);
+        }
+    BVH placements;
+    placements.build(itemBounds);
+
+    // placements of occluder models are drawn into a CPU depth buffer every frame, by the frame's worker threads
+    vector<SceneGraph::NodeId> occluderNodes;
+    for (SceneGraph::NodeId node : placedNodes)
+        if (scene.model(node)->keepOccluder)
+            occluderNodes.push_back(node);
+    ThreadPool framePool;
+    OcclusionCuller occlusion(framePool);
+    // and build the frame's draw lists
+    FrameBuilder frameBuilder(framePool);
+    vector<BVH::ItemId> inView;
+    // the load report is written once the streamed models and textures are in as well
+    bool loadReported = false;
+    // and the render queue's state changes for the first frame drawn with everything loaded
+    bool queueReported = false;
+
     // render loop
     // -----------
     while (!glfwWindowShouldClose(window))
@@ -251,6 +408,18 @@ int main()
         // -----
         processInput(window);
 
+        // finish uploading at most one streamed-in model per frame, and feed its textures through the PBO ring
+        loader.pump(1);
+        uploader.update();
+        // the uploads above bound buffers and textures behind the state cache's back
+        GLState::Instance().beginFrame();
+        if (!loadReported && loader.pending() == 0 && uploader.pending() == 0)
+        {
+            LoadProfiler::Instance().report(std::cout);
+            LoadProfiler::Instance().writeTrace("load_trace.json");
+            loadReported = true;
+        }
+
         // render
         // ------
         glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
@@ -259,254 +428,76 @@ int main()
         // configure transformation matrices
         glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 1000.0f);
         glm::mat4 view = camera.GetViewMatrix();;
+        int viewportWidth, viewportHeight;
+        glfwGetFramebufferSize(window, &viewportWidth, &viewportHeight);
+        frameUniforms.update(view, projection, camera.Position, currentFrame, viewportWidth, viewportHeight);
+        LodContext lodContext(camera.Position, glm::radians(45.0f), (float)SCR_HEIGHT);
         shader.use();
-        shader.setMat4("projection", projection);
-        shader.setMat4("view", view);
-
-
-        float rotAngle = 45;
-
-        // draw circus>
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(-90.0f, -30.0f, -480.0f));
-        model = glm::scale(model, glm::vec3(8.0f, 8.0f, 8.0f));
-        shader.setMat4("model", model);
-        circus.Draw(shader);
-
 
-        // draw ferris wheel>
-        glm::mat4 model1 = glm::mat4(1.0f);
-        model1 = glm::translate(model1, glm::vec3(-100.0f, -30.0f, -100.0f));
-        model1 = glm::scale(model1, glm::vec3(8.0f, 8.0f, 8.0f));
-        model1 = glm::rotate(model1, rotAngle, glm::vec3(0.0f, 0.25f, 0.0f));
-        shader.setMat4("model", model1);
-        ferris_wheel.Draw(shader);
-
-    
-
-        // draw foodcart>
-        glm::mat4 model2 = glm::mat4(1.0f);
-        model2 = glm::translate(model2, glm::vec3(140.0f, -10.0f, -200.0f));
-        model2 = glm::scale(model2, glm::vec3(12.0f, 12.0f, 12.0f));
-        shader.setMat4("model", model2);
-        food_cart.Draw(shader);
-
-        // draw seesaw>
-        glm::mat4 model3 = glm::mat4(1.0f);
-        model3 = glm::translate(model3, glm::vec3(75.0f, -10.0f, -200.0f));
-        model3 = glm::scale(model3, glm::vec3(12.0f, 12.0f, 12.0f));
-        shader.setMat4("model", model3);
-        seesaw.Draw(shader);
-
-
-        //draw food ship cart>
-        glm::mat4 model4 = glm::mat4(1.0f);
-        model4 = glm::translate(model4, glm::vec3(-100.0f, 20.0f, 300.0f));
-        model4 = glm::scale(model4, glm::vec3(8.0f, 8.0f, 8.0f));
-        shader.setMat4("model", model4);
-        ship_food_cart.Draw(shader);
-  
-
-
-        // draw micky>
-        for (unsigned int i = 0; i < 1; i++)
+        // Mickey and the helicopter circle their pivots; every other placement is static and costs nothing here
+        float angle = glfwGetTime() * 5.0f;
+        glm::mat4 orbit = glm::rotate(glm::mat4(1.0f), -glm::radians(angle), glm::vec3(0.0f, 0.5f, 0.0f));
+        scene.setLocal(mickyOrbit, orbit);
+        scene.setLocal(helicopterOrbit, orbit);
+        scene.update();
+        // their boxes are refitted in the BVH, which leaves the rest of the tree as it is
+        for (SceneGraph::NodeId node : scene.changedLastUpdate())
+            if (nodeItems[node] != BVH::NO_ITEM)
+                placements.update(nodeItems[node], placedBounds(scene, streamer, node));
+
+        // streamed models are loaded by distance whether or not they are in view
+        for (SceneGraph::NodeId node : streamedNodes)
+            streamer.Track(*scene.model(node), scene.world(node), camera.Position);
+        // the occluders in view go into the depth buffer first (a streamed one only once resident)
+        Frustum frustum = Frustum::FromMatrix(projection * view);
+        occlusion.begin(projection * view);
+        for (SceneGraph::NodeId node : occluderNodes)
         {
-            // calculate the model matrix for each object and pass it to shader before drawing
-            glm::mat4 model5 = glm::mat4(1.0f);
-            model5 = glm::translate(model5, glm::vec3(-25.0f, -10.0f, 0.0f));
-            model5 = glm::scale(model5, glm::vec3(0.5f, 0.5f, 0.5f));	// it's a bit too big for our scene, so scale it down
-
-            float angle = 2.0f * i;
-            if (i % 3 == 0)  // every 3rd iteration (including the first) we set the angle using GLFW's time function.
-                angle = glfwGetTime() * 5.0f;
-            model5 = glm::rotate(model5, -glm::radians(angle), glm::vec3(0.0f, 0.5f, 0.0f));
-            model5 = glm::translate(model5, glm::vec3(300.0f, 0.0f, 0.0f));
-            model5 = glm::rotate(model5, rotAngle, glm::vec3(0.4f, 0.6f, 0.8f));
-            shader.setMat4("model", model5);
-            micky.Draw(shader);
-
+            const Bounds& box = placements.bounds(nodeItems[node]);
+            if (frustum.intersects(box.low, box.high))
+                occlusion.addOccluder(scene.model(node)->occluderVertices, scene.model(node)->occluderIndices, scene.world(node));
         }
-
-        // draw roller coaster>
-        glm::mat4 model6 = glm::mat4(1.0f);
-        model6 = glm::translate(model6, glm::vec3(-300.0f, -10.0f, -380.0f));
-        model6 = glm::scale(model6, glm::vec3(5.0f, 5.0f, 10.0f));
-        model6 = glm::rotate(model6, rotAngle, glm::vec3(0.0f, 0.15f, 0.0f));
-        shader.setMat4("model", model6);
-        roller_coaster.Draw(shader);
-
-
-        // draw swing>
-        glm::mat4 model7 = glm::mat4(1.0f);
-        model7 = glm::translate(model7, glm::vec3(200.0f, -10.0f, -100.0f));
-        model7 = glm::scale(model7, glm::vec3(0.07f, 0.07f, 0.07f));
-        model7 = glm::rotate(model7, rotAngle, glm::vec3(0.0f, 0.40f, 0.0f));
-        shader.setMat4("model", model7);
-        swing.Draw(shader);
-
-
-        // draw slide>
-        glm::mat4 model8 = glm::mat4(1.0f);
-        model8 = glm::translate(model8, glm::vec3(200.0f, -10.0f, -0.300f));
-        model8 = glm::scale(model8, glm::vec3(6.0f, 6.0f, 6.0f));
-        shader.setMat4("model", model8);
-        slide.Draw(shader);
-
-        // draw sport>
-        glm::mat4 model9 = glm::mat4(1.0f);
-        model9 = glm::translate(model9, glm::vec3(40.0f, -10.0f, -200.0f));
-        model9 = glm::scale(model9, glm::vec3(70.0f, 70.0f, 70.0f));
-        shader.setMat4("model", model9);
-        sport.Draw(shader);
-
-        // draw hot air baloon near >
-        glm::mat4 model10 = glm::mat4(1.0f);
-        model10 = glm::translate(model10, glm::vec3(40.0f, 30.0f, 0.0f));
-        model10 = glm::scale(model10, glm::vec3(0.70f, 0.70f, 0.70f));
-        model10 = glm::rotate(model10, rotAngle, glm::vec3(0.0f, -0.15f, 0.0f));
-        shader.setMat4("model", model10);
-        hot_air_baloon.Draw(shader);
-
-        // draw carosel>
-        glm::mat4 model11 = glm::mat4(1.0f);
-        model11 = glm::translate(model11, glm::vec3(305.0f, -10.0f, -100.0f));
-        model11 = glm::scale(model11, glm::vec3(20.0f, 20.0f, 20.0f));
-        shader.setMat4("model", model11);
-        carosel.Draw(shader);
-
-        // draw carosel2>
-        glm::mat4 model12 = glm::mat4(1.0f);
-        model12 = glm::translate(model12, glm::vec3(55.0f, -10.0f, -200.0f));
-        model12 = glm::scale(model12, glm::vec3(6.0f, 6.0f, 6.0f));
-        shader.setMat4("model", model12);
-        carosel2.Draw(shader);
-
-        // draw waterbike >
-        glm::mat4 model13 = glm::mat4(1.0f);
-        model13 = glm::translate(model13, glm::vec3(-45.0f, -20.0f, 90.0f));
-        model13 = glm::scale(model13, glm::vec3(3.0f, 3.0f, 3.0f));
-        shader.setMat4("model", model13);
-        bike.Draw(shader);
-
-
-        // draw hot air baloon far>
-        glm::mat4 model14 = glm::mat4(1.0f);
-        model14 = glm::translate(model14, glm::vec3(340.0f, 40.0f, 45.0f));
-        model14 = glm::scale(model14, glm::vec3(0.70f, 0.70f, 0.70f));
-        model14 = glm::rotate(model14, rotAngle, glm::vec3(0.0f, -0.15f, 0.0f));
-        shader.setMat4("model", model14);
-        hot_air_baloon.Draw(shader);
-
-
-        // draw waterbike >
-        glm::mat4 model15 = glm::mat4(1.0f);
-        model15 = glm::translate(model15, glm::vec3(0.0f, -20.0f, 90.0f));
-        model15 = glm::scale(model15, glm::vec3(3.0f, 3.0f, 3.0f));
-        shader.setMat4("model", model15);
-        bike.Draw(shader);
-
-        // draw claw>
-        glm::mat4 model16 = glm::mat4(1.0f);
-        model16 = glm::translate(model16, glm::vec3(20.0f, -10.0f, -160.0f));
-        model16 = glm::scale(model16, glm::vec3(6.0f, 6.0f, 6.0f));
-        shader.setMat4("model", model16);
-        claw.Draw(shader);
-
-        // draw helicopter
-
-        for (unsigned int i = 0; i < 1; i++)
+        occlusion.render();
+        // the worker threads take the placements in view, drop those hidden behind the occluders and record the
+        // rest with their levels of detail, streamed ones as placeholders until resident (see ModelStreamer::Submit)
+        inView.clear();
+        placements.query(frustum, [&](BVH::ItemId item) { inView.push_back(item); });
+        renderQueue.begin(camera.Position, 1000.0f, projection * view, frameBuilder.workers());
+        frameBuilder.build(renderQueue, inView.size(), [&](CommandList& list, size_t i) {
+            SceneGraph::NodeId node = placedNodes[inView[i]];
+            if (!scene.model(node)->keepOccluder && !occlusion.visible(placements.bounds(inView[i])))
+                return;
+            streamer.Submit(list, *scene.model(node), shader, scene.world(node), lodContext, scene.lodLevel(node));
+        });
+
+        // which leaves only the GL calls here
+        renderQueue.execute(&framePool);
+        if (loadReported && !queueReported)
         {
-            // calculate the model matrix for each object and pass it to shader before drawing
-            glm::mat4 model17 = glm::mat4(1.0f);
-            model17 = glm::translate(model17, glm::vec3(0.0f, 40.0f, 90.0f));
-            model17 = glm::scale(model17, glm::vec3(0.01f, 0.01f, 0.01f));	// it's a bit too big for our scene, so scale it down
-
-            float angle = 2.0f * i;
-            if (i % 3 == 0)  // every 3rd iteration (including the first) we set the angle using GLFW's time function.
-                angle = glfwGetTime() * 5.0f;
-            model17 = glm::rotate(model17, -glm::radians(angle), glm::vec3(0.0f, 0.5f, 0.0f));
-            model17 = glm::translate(model17, glm::vec3(300.0f, 0.0f, 0.0f));
-            model17 = glm::rotate(model17, rotAngle, glm::vec3(0.0f, 0.8f, 0.0f));
-            shader.setMat4("model", model17);
-            helicopter.Draw(shader);
-
+            renderQueue.report(std::cout);
+            GLState::Instance().report(std::cout);
+            occlusion.report(std::cout);
+            frameBuilder.report(std::cout);
+            queueReported = true;
         }
 
-        //draw carausel3 >
-        glm::mat4 model20 = glm::mat4(1.0f);
-        model20 = glm::translate(model20, glm::vec3(85.0f, -10.0f, 20.0f));
-        model20 = glm::scale(model20, glm::vec3(3.0f, 3.0f, 3.0f));
-        shader.setMat4("model", model20);
-        carousel3.Draw(shader);
-
-        //water game
-        glm::mat4 model21 = glm::mat4(1.0f);
-        model21 = glm::translate(model21, glm::vec3(50.0f, -20.0f, 170.0f));
-        model21 = glm::scale(model21, glm::vec3(12.0f, 12.0f, 12.0f));
-        shader.setMat4("model", model21);
-        water.Draw(shader);
-
-
-
-        // draw palace >
-        glm::mat4 model22 = glm::mat4(1.0f);
-        model22 = glm::translate(model22, glm::vec3(-400.0f, -20.0f, 1850.0f));
-        model22 = glm::scale(model22, glm::vec3(150.0f, 150.0f, 150.0f));
-        shader.setMat4("model", model22);
-        palace.Draw(shader);
-
-
-        //draw tire
-
-        glm::mat4 model24 = glm::mat4(1.0f);
-        model24 = glm::translate(model24, glm::vec3(-40.0f, -20.0f, 360.0f));
-        model24 = glm::scale(model24, glm::vec3(0.05f, 0.05f, 0.05f));
-        model24 = glm::rotate(model24, rotAngle, glm::vec3(0.0f, -0.15f, 0.0f));
-        shader.setMat4("model", model24);
-        tire.Draw(shader);
-
-
-        //draw fountain
-
-        glm::mat4 model29 = glm::mat4(1.0f);
-        model29 = glm::translate(model29, glm::vec3(40.0f, -10.0f, -50.0f));
-        model29 = glm::scale(model29, glm::vec3(3.0f, 3.0f, 3.0f));
-        //model29 = glm::rotate(model29, rotAngle, glm::vec3(0.0f, 0.15f, 0.0f));
-        shader.setMat4("model", model29);
-        fountain.Draw(shader);
-
-
-        //draw bench
-        glm::mat4 model30 = glm::mat4(1.0f);
-        model30 = glm::translate(model30, glm::vec3(1850.0f, -10.0f, -10.0f));
-        model30 = glm::scale(model30, glm::vec3(5.0f, 5.0f, 10.0f));
-        model30 = glm::rotate(model30, rotAngle, glm::vec3(0.0f, 0.15f, 0.0f));
-        shader.setMat4("model", model30);
-        bench.Draw(shader);
-
-        // draw palace2> 
-        glm::mat4 model33 = glm::mat4(1.0f);
-        model33 = glm::translate(model33, glm::vec3(-400.0f, -20.0f, 1050.0f));
-        model33 = glm::scale(model33, glm::vec3(150.0f, 150.0f, 150.0f));
-        shader.setMat4("model", model33);
-        palace.Draw(shader);
-       
-
-
-
         // draw skybox as last
-        glDepthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
+        GLState::Instance().setDepthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
         skyboxShader.use();
-        view = glm::mat4(glm::mat3(camera.GetViewMatrix())); // remove translation from the view matrix
-        skyboxShader.setMat4("view", view);
-        skyboxShader.setMat4("projection", projection);
         // skybox cube
-        glBindVertexArray(skyboxVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+        GLState::Instance().bindVertexArray(skyboxVAO);
+        GLState::Instance().bindTexture(0, GL_TEXTURE_CUBE_MAP, cubemapTexture);
         glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
-        glDepthFunc(GL_LESS); // set depth function back to default
+        GLState::Instance().setDepthFunc(GL_LESS); // set depth function back to default
+
+        // start loading what the camera approached this frame, unload what it left behind; a model that came in
+        // may have brought better bounds than its cache header, so the tree is built again
+        if (streamer.update(glfwGetTime()))
+        {
+            for (BVH::ItemId item = 0; item < placedNodes.size(); item++)
+                itemBounds[item] = placedBounds(scene, streamer, placedNodes[item]);
+            placements.build(itemBounds);
+        }
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
@@ -520,6 +511,10 @@ int main()
     glDeleteVertexArrays(1, &skyboxVAO);
     //  glDeleteBuffers(1, &cubeVBO);
     glDeleteBuffers(1, &skyboxVBO);
+    frameUniforms.release();
+    renderQueue.release();
+    streamer.release();
+    uploader.release();
 
     glfwTerminate();
     return 0;
@@ -580,43 +575,31 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
     camera.ProcessMouseScroll(static_cast<float>(yoffset));
 }
 
+// model matrix of a placement: moved to position, scaled, then rotated by angle (radians) about axis
+// ---------------------------------------------------------------------------------------------------
+glm::mat4 placement(const glm::vec3& position, const glm::vec3& scale, float angle, const glm::vec3& axis)
+{
+    glm::mat4 model = glm::mat4(1.0f);
+    model = glm::translate(model, position);
+    model = glm::scale(model, scale);
+    if (angle != 0.0f)
+        model = glm::rotate(model, angle, axis);
+    return model;
+}
+
+// world box of a node's model (see ModelStreamer::bounds) at the node's world transform
+Bounds placedBounds(const SceneGraph& scene, const ModelStreamer& streamer, SceneGraph::NodeId node)
+{
+    glm::vec3 low, high;
+    streamer.bounds(*scene.model(node), low, high);
+    return TransformBounds(scene.world(node), Bounds(low, high));
+}
+
 // utility function for loading a 2D texture from file
 // ---------------------------------------------------
 unsigned int loadTexture(char const* path)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    unsigned char* data = stbi_load(path, &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
-
-    return textureID;
+    return TextureFromFile(path, "");
 }
 
 // loads a cubemap texture from 6 individual texture faces
@@ -627,34 +610,62 @@ unsigned int loadTexture(char const* path)
 // -Y (bottom)
 // +Z (front) 
 // -Z (back)
+// the six faces together are one TextureRegistry entry, so loading the same set again shares the texture
 // -------------------------------------------------------
 unsigned int loadCubemap(vector<std::string> faces)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+    string key = "cubemap:";
+    for (unsigned int i = 0; i < faces.size(); i++)
+        key += (i ? "|" : "") + TextureRegistry::CanonicalPath(faces[i]);
+
+    TextureRegistry& registry = TextureRegistry::Instance();
+    bool claimed = registry.claim(key);
+    unsigned int textureID = registry.acquire(key);
+    if (!claimed)
+        return textureID;
+
     glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
-    int width, height, nrChannels;
+    size_t bytes = 0;
     for (unsigned int i = 0; i < faces.size(); i++)
     {
-        unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-        if (data)
+        ImageData image;
+        image.path = faces[i];
+        image.key = TextureRegistry::CanonicalPath(faces[i]);
+        DecodeImage(image, "");
+        LoadScope scope(image.key, "upload");
+        if (image.compressedFormat)
+        {
+            scope.textureBytes = UploadCompressedImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, image);
+            bytes += scope.textureBytes;
+        }
+        else if (image.pixels)
         {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
+            bytes += size_t(image.width) * image.height * image.components;
+            if (TextureUploader* uploader = TextureUploader::Current())
+            {
+                // the bytes are counted as the uploader sends them
+                uploader->queue(textureID, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, image, false);
+            }
+            else
+            {
+                GLenum format = ImageFormat(image.components);
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.pixels);
+                scope.textureBytes = size_t(image.width) * image.height * image.components;
+            }
         }
         else
         {
             std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
         }
+        FreeImage(image);
     }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    registry.setBytes(textureID, bytes);
 
     return textureID;
 }
-